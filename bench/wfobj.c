@@ -0,0 +1,93 @@
+/* wfobj.c: wavefront object loader scaling benchmark
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TAG "bench"
+
+#include <rgu/log.h>
+#include <rgu/time.h>
+#include <rgu/wfobj.h>
+
+#define RUNS 3
+
+static uint8_t run(const char *path, uint8_t threads, uint32_t *best)
+{
+	*best = UINT32_MAX;
+
+	for (uint8_t i = 0; i < RUNS; ++i) {
+		struct model model = {0};
+		char *tmp = strdup(path); /* prepare_model keeps basename */
+
+		model.rgb.r = -1;
+		model.threads = threads;
+
+		uint32_t start = time_ms();
+
+		if (!prepare_model(tmp, &model, NULL)) {
+			ee("failed to load %s\n", path);
+			free(tmp);
+			return 0;
+		}
+
+		uint32_t ms = time_ms() - start;
+
+		if (ms < *best)
+			*best = ms;
+
+		erase_model(&model);
+		free(tmp);
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct stat st;
+
+	if (argc < 2) {
+		printf("usage: %s <model.obj> [max threads]\n", argv[0]);
+		return 1;
+	} else if (stat(argv[1], &st) < 0) {
+		ee("failed to stat %s\n", argv[1]);
+		return 1;
+	}
+
+	long max = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (max < 1)
+		max = 1;
+	else if (max > UINT8_MAX)
+		max = UINT8_MAX;
+
+	uint32_t base = 0;
+	float mb = st.st_size / (1024. * 1024.);
+
+	fprintf(stderr, "%-8s %-10s %-10s %s\n", "threads", "ms", "MB/s",
+	  "speedup");
+
+	for (long threads = 1; threads <= max; ++threads) {
+		uint32_t ms;
+
+		if (!run(argv[1], threads, &ms))
+			continue; /* no timing to report */
+		else if (!ms)
+			ms = 1;
+
+		if (!base)
+			base = ms;
+
+		fprintf(stderr, "%-8ld %-10u %-10.1f %.2fx\n", threads, ms,
+		  mb / (ms / 1000.), (float) base / ms);
+	}
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+/* etc.c: etc1 encoder and reference decoder check
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TAG "check"
+
+#include <rgu/log.h>
+#include <rgu/etc.h>
+
+#define MIN_PSNR 35.f /* db, smooth images */
+#define MAX_SOLID_ERROR 8 /* per plane, single color images */
+
+/* hand made blocks, see khronos etc1 specification */
+
+static uint8_t decode_blocks(void)
+{
+	/* individual mode, base 0x8 -> 136, table 0 { 2, 8 }, texel (0, 0)
+	 * has msb set, i.e. index 2 -> -2, rest are index 0 -> +2 */
+	static const uint8_t individual[] = {
+		0x88, 0x88, 0x88, 0x00, 0x00, 0x01, 0x00, 0x00,
+	};
+
+	/* differential mode, base 0x10 -> 132 and delta -1 -> 0x0f -> 123,
+	 * table 1 { 5, 17 }, flip set: top two rows use first subblock */
+	static const uint8_t differential[] = {
+		0x87, 0x87, 0x87, 0x27, 0x00, 0x00, 0x00, 0x00,
+	};
+	uint8_t rgb[16 * 3];
+
+	etc1_decode(individual, 4, 4, rgb);
+
+	for (uint8_t i = 0; i < 16 * 3; ++i) {
+		uint8_t expected = i < 3 ? 134 : 138;
+
+		if (rgb[i] != expected) {
+			ee("individual block byte %u is %u, expected %u\n", i,
+			  rgb[i], expected);
+			return 0;
+		}
+	}
+
+	etc1_decode(differential, 4, 4, rgb);
+
+	for (uint8_t i = 0; i < 16 * 3; ++i) {
+		uint8_t expected = i / 3 / 4 < 2 ? 137 : 128;
+
+		if (rgb[i] != expected) {
+			ee("differential block byte %u is %u, expected %u\n", i,
+			  rgb[i], expected);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* continuous triangle wave in [32, 223] so slope does not depend on size */
+
+static inline uint8_t ramp(uint32_t v)
+{
+	v %= 382;
+	return 32 + (v < 191 ? v : 381 - v);
+}
+
+static void fill_gradient(uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes)
+{
+	for (uint16_t y = 0; y < h; ++y) {
+		for (uint16_t x = 0; x < w; ++x, pixels += planes) {
+			pixels[0] = ramp(x * 3);
+			pixels[1] = ramp(y * 2);
+			pixels[2] = ramp(x + y);
+
+			if (planes == 4)
+				pixels[3] = rand(); /* must be ignored */
+		}
+	}
+}
+
+static void fill_solid(uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes)
+{
+	uint8_t color[4] = { rand(), rand(), rand(), rand() };
+
+	for (uint32_t i = 0; i < (uint32_t) w * h; ++i, pixels += planes)
+		memcpy(pixels, color, planes);
+}
+
+static uint8_t round_trip(uint16_t w, uint16_t h, uint8_t planes,
+  uint8_t solid)
+{
+	size_t len = (size_t) w * h;
+	uint8_t *pixels = malloc(len * planes);
+	uint8_t *data = malloc(etc1_size(w, h));
+	uint8_t *rgb = malloc(len * 3);
+	uint8_t ret = 0;
+
+	if (!pixels || !data || !rgb) {
+		ee("failed to allocate %ux%u image\n", w, h);
+		goto out;
+	}
+
+	if (solid)
+		fill_solid(pixels, w, h, planes);
+	else
+		fill_gradient(pixels, w, h, planes);
+
+	etc1_encode(pixels, w, h, planes, data);
+	etc1_decode(data, w, h, rgb);
+
+	double sum = 0;
+	uint8_t max = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		for (uint8_t c = 0; c < 3; ++c) {
+			int d = pixels[i * planes + c] - rgb[i * 3 + c];
+
+			sum += d * d;
+			max = abs(d) > max ? abs(d) : max;
+		}
+	}
+
+	float psnr = sum ? 10 * log10(255. * 255. * len * 3 / sum) : INFINITY;
+
+	ii("%ux%u planes %u %s | psnr %.1f db, max error %u\n", w, h, planes,
+	  solid ? "solid" : "gradient", psnr, max);
+
+	if (solid && max > MAX_SOLID_ERROR) {
+		ee("solid %ux%u is off by %u\n", w, h, max);
+	} else if (!solid && psnr < MIN_PSNR) {
+		ee("gradient %ux%u psnr %.1f db is too low\n", w, h, psnr);
+	} else {
+		ret = 1;
+	}
+
+out:
+	free(pixels);
+	free(data);
+	free(rgb);
+	return ret;
+}
+
+int main(void)
+{
+	static const uint16_t sizes[][2] = {
+		{ 1, 1 }, { 4, 4 }, { 13, 7 }, { 64, 33 }, { 256, 256 },
+	};
+	uint8_t ok = decode_blocks();
+
+	srand(1);
+
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		for (uint8_t planes = 3; planes <= 4; ++planes) {
+			ok &= round_trip(sizes[i][0], sizes[i][1], planes, 0);
+			ok &= round_trip(sizes[i][0], sizes[i][1], planes, 1);
+		}
+	}
+
+	printf("etc1 %s\n", ok ? "ok" : "failed");
+
+	return !ok;
+}
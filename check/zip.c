@@ -0,0 +1,98 @@
+/* zip.c: zip reader check, see zip.sh
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "check"
+
+#include <rgu/log.h>
+#include <rgu/zip.h>
+
+static void usage(const char *name)
+{
+	printf("usage: %s <archive> stored|inflated|missing <path> ...\n"
+	  "\neach path is looked up in archive, found entries are compared "
+	  "with file\nof same path\n", name);
+}
+
+static uint8_t same_file(const char *path, const struct asset_info *ainfo)
+{
+	FILE *fp = fopen(path, "rb");
+	uint8_t *buf = malloc(ainfo->len + 1);
+	uint8_t ret = 0;
+
+	if (!fp || !buf) {
+		ee("failed to read %s\n", path);
+	} else if (fread(buf, 1, ainfo->len + 1, fp) != ainfo->len) {
+		ee("%s length differs from %u\n", path, ainfo->len);
+	} else if (memcmp(buf, ainfo->buf, ainfo->len) != 0) {
+		ee("%s content differs\n", path);
+	} else {
+		ret = 1;
+	}
+
+	if (fp)
+		fclose(fp);
+
+	free(buf);
+	return ret;
+}
+
+static uint8_t check_path(const char *path, const char *expect)
+{
+	struct asset_info ainfo;
+	uint8_t found = zip_find(path, &ainfo);
+	uint8_t ret = 0;
+
+	if (strcmp(expect, "missing") == 0) {
+		if (found) {
+			ee("%s is found\n", path);
+			put_asset(&ainfo);
+		}
+
+		return !found;
+	} else if (!found) {
+		ee("%s is not found\n", path);
+		return 0;
+	}
+
+	uint8_t source = strcmp(expect, "stored") == 0 ? ASSET_ZIP :
+	  ASSET_INFLATED;
+
+	if (ainfo.source != source) {
+		ee("%s source is %u, expected %u\n", path, ainfo.source,
+		  source);
+	} else {
+		ret = same_file(path, &ainfo);
+	}
+
+	put_asset(&ainfo);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t ok = 1;
+
+	if (argc < 4) {
+		usage(argv[0]);
+		return 1;
+	} else if (!zip_mount(argv[1])) {
+		return 1;
+	}
+
+	for (int i = 3; i < argc; ++i)
+		ok &= check_path(argv[i], argv[2]);
+
+	zip_unmount();
+	printf("%s %s\n", argv[1], ok ? "ok" : "failed");
+
+	return !ok;
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# zip.sh: check zip reader against archives made by zip(1)
+#
+# Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+#
+# This source code is licensed under the BSD Zero Clause License found in
+# the 0BSD file in the root directory of this source tree.
+#
+# usage: zip.sh <zip-check binary>
+
+set -e
+
+bin=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p a/b
+seq 1 50000 > a/text.txt
+head -c 65536 /dev/urandom > a/b/rand.bin
+printf 'x' > a/b/one
+
+# stored entries point into mapping
+
+zip -q -0 -r stored.zip a
+"$bin" stored.zip stored a/text.txt a/b/rand.bin a/b/one ./a//b/rand.bin
+"$bin" stored.zip missing a/nope a/b
+
+# deflated entries are inflated and crc checked
+
+zip -q -9 -r deflated.zip a
+"$bin" deflated.zip inflated a/text.txt a/b/../text.txt
+
+# names as written by other tools, lookup is done on normalized path
+
+cp stored.zip odd.zip
+zipnote odd.zip | sed -e 's|^@ a/text.txt$|&\n@=./a/text.txt|' \
+  -e 's|^@ a/b/rand.bin$|&\n@=a//b/rand.bin|' | zipnote -w odd.zip
+unzip -Z1 odd.zip | grep -qx './a/text.txt'
+"$bin" odd.zip stored a/text.txt a/b/rand.bin
+
+# invert byte in the middle of deflated stream
+
+zip -q -9 corrupt.zip a/text.txt
+pos=$(($(wc -c < corrupt.zip) / 2))
+byte=$(od -An -tu1 -j $pos -N1 corrupt.zip)
+printf "\\$(printf %o $((byte ^ 255)))" |
+  dd of=corrupt.zip bs=1 seek=$pos conv=notrunc 2>/dev/null
+"$bin" corrupt.zip missing a/text.txt
@@ -8,18 +8,68 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+enum asset_source {
+	ASSET_FILE, /* file mapping owned by asset */
+	ASSET_ANDROID, /* AAsset buffer */
+	ASSET_PACK, /* inside mounted pack, nothing to release */
+	ASSET_ZIP, /* stored entry of mounted archive, nothing to release */
+	ASSET_INFLATED, /* pooled buffer */
+	ASSET_CACHED, /* shared through asset cache */
+};
+
+#define ASSET_BUDGET (32 << 20) /* default bytes of resident assets */
+
+enum asset_trim {
+	ASSET_TRIM_IDLE, /* release unreferenced assets */
+	ASSET_TRIM_ALL, /* also drop pages of referenced file mappings */
+};
+
+struct asset_stats {
+	uint32_t assets; /* cached, referenced or idle */
+	uint32_t idle;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+	uint64_t resident; /* bytes of cached assets */
+};
+
 struct asset_info {
 	const unsigned char *buf;
 	uint32_t len;
 	const void *asset;
 	int fd;
+	uint8_t source; /* enum asset_source */
+	size_t capacity; /* bytes of pooled buffer if ASSET_INFLATED */
 };
 
+/* drop empty and "." segments and fold ".." so that equal paths match */
+
+void normalize_path(const char *path, char *buf, size_t size);
+
+/*
+ * assets are shared by path: repeated get_asset() of same path takes
+ * reference to one mapping which put_asset() drops; unreferenced assets
+ * stay resident until budget is exceeded, least recently used go first;
+ * any thread
+ *
+ * */
+
 void put_asset(struct asset_info *);
 uint8_t get_asset(const char *path, struct asset_info *, const void *amgr);
 
+/* limit bytes of resident assets; referenced ones are never evicted */
+
+void asset_set_budget(size_t bytes);
+
+/* release memory on pressure, e.g. from onTrimMemory() on android */
+
+void asset_trim(uint8_t level);
+
+void asset_stats(struct asset_stats *stats);
+
 struct image_info {
 	void *image;
 	int w;
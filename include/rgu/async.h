@@ -0,0 +1,73 @@
+/* async.h: background model loading
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <rgu/wfobj.h>
+
+struct async_loader;
+struct async_job;
+
+struct async_request {
+	char *path; /* must stay valid while model lives, see prepare_model() */
+	struct model *model;
+	void *amgr;
+
+	/* called on worker thread whenever preparation progress changes */
+	void (*progress)(struct model *model, uint8_t percent, void *data);
+
+	/* called on gl thread from async_complete() once model is uploaded;
+	 * failed or cancelled models are already erased when ok is 0; model
+	 * is left untouched if job is cancelled before it starts */
+	void (*done)(struct model *model, uint8_t ok, void *data);
+
+	void *data;
+};
+
+/*
+ * start worker threads that parse models and decode their textures
+ *
+ * @arg workers  number of worker threads, 0 means one
+ * @ret          loader handle, NULL on failure
+ *
+ * */
+
+struct async_loader *async_start(uint8_t workers);
+
+/* cancel pending jobs, join workers and erase models not yet completed;
+ * call from gl thread */
+
+void async_stop(struct async_loader *loader);
+
+/*
+ * queue model for background loading
+ *
+ * @ret  job handle valid until done() callback is called, NULL on failure
+ *
+ * */
+
+struct async_job *async_load(struct async_loader *loader,
+  const struct async_request *req);
+
+/* request job cancellation; done() is still called with ok 0 */
+
+void async_cancel(struct async_job *job);
+
+/*
+ * drain completion queue and upload finished models; call from gl thread
+ * once per frame
+ *
+ * @arg budget_us  upload time budget, at least one upload step is run if
+ *                 any model is ready
+ * @ret            number of models completed by this call
+ *
+ * */
+
+uint16_t async_complete(struct async_loader *loader, uint32_t budget_us);
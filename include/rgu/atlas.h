@@ -0,0 +1,56 @@
+/* atlas.h: texture atlas packing
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define ATLAS_ALIGN 4 /* rects start and end at multiples of this */
+
+struct atlas_node {
+	uint16_t x;
+	uint16_t y;
+	uint16_t w;
+};
+
+/* skyline packer, each node is a horizontal segment of packed area top */
+
+struct atlas {
+	uint16_t w;
+	uint16_t h;
+	uint16_t used_h; /* lowest height that fits all packed rects */
+	uint16_t nodes_num;
+	uint16_t nodes_max;
+	struct atlas_node *nodes;
+};
+
+uint8_t atlas_init(struct atlas *atlas, uint16_t w, uint16_t h);
+void atlas_release(struct atlas *atlas);
+
+/*
+ * reserve w x h rect at bottom-left most position of skyline; size is
+ * rounded up to ATLAS_ALIGN
+ *
+ * @ret  1 upon success, 0 if rect does not fit
+ *
+ * */
+
+uint8_t atlas_pack(struct atlas *atlas, uint16_t w, uint16_t h, uint16_t *x,
+  uint16_t *y);
+
+/*
+ * copy image into atlas pixels at x + pad, y + pad and fill pad texels
+ * around it, up to rect size rounded by atlas_pack(), with its edge texels,
+ * so that filtering and lower mip levels do not pick up neighbours or
+ * filler; rgb source is widened if atlas is rgba
+ *
+ * */
+
+void atlas_blit(uint8_t *dst, uint16_t dw, uint8_t dplanes,
+  const uint8_t *src, uint16_t sw, uint16_t sh, uint8_t splanes,
+  uint16_t x, uint16_t y, uint8_t pad);
@@ -0,0 +1,52 @@
+/* cook.h: binary cache of prepared models
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rgu/wfobj.h>
+
+struct cooked {
+	const uint8_t *buf;
+	size_t len;
+};
+
+uint64_t cook_hash(const void *buf, size_t len, uint64_t seed);
+
+/*
+ * save prepared model shapes, extents and texture names
+ *
+ * @arg path   cooked file path
+ * @arg key    hash of model source and loader options
+ * @arg model  model with prepared but not yet uploaded shapes
+ * @ret        1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t cook_save(const char *path, uint64_t key, struct model *model);
+
+/*
+ * map cooked file and append its shapes to model; shape arrays and indices
+ * point straight into mapping which stays valid until cook_unmap()
+ *
+ * @ret        number of loaded shapes, 0 on failure, key mismatch or more
+ *             than UINT16_MAX shapes
+ *
+ * */
+
+uint16_t cook_load(const char *path, uint64_t key, struct model *model,
+  struct cooked *cooked);
+void cook_unmap(struct cooked *cooked);
+
+static inline uint8_t cook_owns(const struct cooked *cooked, const void *ptr)
+{
+	return cooked->buf && (const uint8_t *) ptr >= cooked->buf &&
+	  (const uint8_t *) ptr < cooked->buf + cooked->len;
+}
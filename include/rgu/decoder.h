@@ -0,0 +1,50 @@
+/* decoder.h: image decoder registry
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <rgu/asset.h>
+#include <rgu/image.h>
+
+enum image_type {
+	IMAGE_PNG,
+	IMAGE_JPEG,
+	IMAGE_OTHER, /* whatever stb_image knows: bmp, tga, gif, psd, pnm */
+	IMAGE_TYPES,
+};
+
+struct decoder_stats {
+	uint32_t images;
+	uint32_t failures;
+	uint64_t usecs; /* time spent in decoder */
+	uint64_t bytes; /* decoded pixel bytes */
+};
+
+/* format of encoded image by its signature */
+
+uint8_t image_type(const uint8_t *buf, uint32_t len);
+
+/*
+ * decode image from asset memory with fastest backend built in: libpng
+ * and libjpeg if available, stb_image otherwise; pixels are written
+ * straight into buffer taken from pool; can run on any thread
+ *
+ * @arg image  GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB or GL_RGBA pixels
+ * @ret        1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t image_decode(const struct asset_info *ainfo, struct image *image);
+
+/* give pixel buffer back to pool, see pool_trim() */
+
+void image_release(struct image *image);
+
+void decoder_stats(uint8_t type, struct decoder_stats *stats);
@@ -0,0 +1,30 @@
+/* dither.h: 16-bit texel conversion
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum dither_mode {
+	DITHER_NONE, /* round to nearest level */
+	DITHER_ORDERED, /* 4x4 bayer matrix */
+	DITHER_DIFFUSE, /* floyd-steinberg error diffusion */
+};
+
+/*
+ * convert rgb or rgba pixels to MIP_RGB565, MIP_RGBA4444 or MIP_RGBA5551
+ * texels; rgb gets opaque alpha, 1-bit alpha is thresholded and never
+ * dithered; gl is not touched, can run on any thread
+ *
+ * @arg dst  w * h texels
+ * @ret      1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t dither_pack16(const uint8_t *src, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t format, uint8_t mode, uint16_t *dst);
@@ -0,0 +1,37 @@
+/* etc.h: etc1 texture compression
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define ETC1_BLOCK_BYTES 8 /* 4x4 rgb texels */
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+
+static inline uint32_t etc1_size(uint16_t w, uint16_t h)
+{
+	return ((w + 3) / 4) * ((h + 3) / 4) * ETC1_BLOCK_BYTES;
+}
+
+/*
+ * compress rgb or rgba image, alpha is dropped; partial edge blocks repeat
+ * edge texels; gl is not touched, can run on any thread
+ *
+ * @arg out  etc1_size() bytes
+ *
+ * */
+
+void etc1_encode(const uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t *out);
+
+/* reference decoder to tightly packed rgb, used when driver lacks etc1 */
+
+void etc1_decode(const uint8_t *data, uint16_t w, uint16_t h, uint8_t *rgb);
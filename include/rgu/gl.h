@@ -10,6 +10,7 @@
 #define GL_GLEXT_PROTOTYPES
 #define EGL_EGLEXT_PROTOTYPES
 
+#include <stdint.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
@@ -46,3 +47,4 @@
 }
 
 GLuint gl_make_prog(const char *vsrc, const char *fsrc);
+uint8_t gl_extension(const char *name);
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <GLES2/gl2.h>
 
@@ -15,12 +16,51 @@ struct image {
 	uint16_t w;
 	uint16_t h;
 	GLuint format;
+	size_t size; /* bytes data can hold, may exceed w * h * planes */
 };
 
+/* decoders are reentrant; image memory is allocated with malloc() and
+ * released by caller */
+
 uint8_t buf2png(const uint8_t *buf, struct image *image);
 uint8_t readpng(const char *path, struct image *image);
 uint8_t readjpg(const char *path, struct image *image);
 
+/*
+ * decode png from memory straight into dst if it holds size bytes, else
+ * into allocated memory; image->data tells which one was used
+ *
+ * @arg len  buffer length, 0 if unknown
+ * @ret      1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t png_decode(const uint8_t *buf, size_t len, struct image *image,
+  uint8_t *dst, size_t size);
+
+/* jpeg output; planes 1 is GL_LUMINANCE, 3 GL_RGB and 4 GL_RGBA with
+ * opaque alpha; scale 1, 2, 4 or 8 decodes at 1/scale size in dct domain,
+ * NULL options are 1 plane at full size */
+
+struct jpg_opts {
+	uint8_t planes;
+	uint8_t scale;
+};
+
+uint8_t readjpg_opts(const char *path, const struct jpg_opts *opts,
+  struct image *image);
+
+/*
+ * decode jpeg from memory straight into dst if it holds size bytes, else
+ * into allocated memory; image->data tells which one was used
+ *
+ * @ret  1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t jpg_decode(const uint8_t *buf, size_t len, const struct jpg_opts *opts,
+  struct image *image, uint8_t *dst, size_t size);
+
 void writepng(const char *path, const uint8_t *buf, uint16_t w, uint16_t h);
 
 void fillrect(uint32_t *buf, uint32_t *end, uint32_t color);
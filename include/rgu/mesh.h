@@ -0,0 +1,46 @@
+/* mesh.h: triangle mesh optimization helpers
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define MESH_CACHE_SIZE 16 /* post-transform cache entries on mobile gpus */
+
+/*
+ * average cache miss ratio: transformed vertices per triangle with fifo
+ * post-transform cache; 0.5 is ideal, 3 means no reuse at all
+ *
+ * */
+
+float mesh_acmr(const uint32_t *indices, uint32_t indices_num,
+  uint32_t vertices_num, uint8_t cache_size);
+
+/*
+ * reorder triangles for post-transform cache (tipsify) and then clusters of
+ * triangles from outside to inside to cut overdraw
+ *
+ * @arg indices       triangle list; reordered in place
+ * @arg array         interleaved vertices, position is first 3 floats
+ * @arg stride        vertex size in floats
+ * @ret               1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t mesh_optimize_triangles(uint32_t *indices, uint32_t indices_num,
+  const float *array, uint32_t vertices_num, uint32_t stride,
+  uint8_t cache_size);
+
+/*
+ * reorder vertices to follow first use in index buffer so fetches stay
+ * sequential; indices are remapped accordingly
+ *
+ * */
+
+uint8_t mesh_optimize_vertices(uint32_t *indices, uint32_t indices_num,
+  float *array, uint32_t vertices_num, uint32_t stride);
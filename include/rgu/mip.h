@@ -0,0 +1,56 @@
+/* mip.h: mip chain builder
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define MIP_MAX_LEVELS 16
+
+enum mip_format {
+	MIP_RAW, /* 8 bits per plane */
+	MIP_ETC1, /* etc1 blocks, see rgu/etc.h */
+	MIP_RGB565, /* 16-bit texels, see rgu/dither.h */
+	MIP_RGBA4444,
+	MIP_RGBA5551,
+	MIP_L8, /* luminance */
+	MIP_LA8, /* luminance and alpha */
+};
+
+struct mip_level {
+	uint16_t w;
+	uint16_t h;
+	uint32_t offset; /* bytes into chain data */
+	uint32_t size; /* bytes */
+};
+
+struct mip_chain {
+	uint8_t *data; /* all levels, tightly packed rows */
+	uint32_t size;
+	uint8_t planes; /* 3 for rgb or 4 for rgba */
+	uint8_t format; /* enum mip_format */
+	uint8_t levels;
+	struct mip_level level[MIP_MAX_LEVELS];
+};
+
+/*
+ * build mip chain down to 1x1 with 2x2 box filter applied in linear space,
+ * last row and column of odd sizes are folded into 3x2 or 3x3 boxes;
+ * color planes are treated as srgb and alpha as linear; level 0 is copied
+ * so chain owns all its data; gl is not touched, can run on any thread
+ *
+ * @arg pixels  rgb or rgba pixels, tightly packed rows
+ * @arg levels  maximum number of levels, 0 for full chain
+ * @ret         1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t mip_build(const uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t levels, struct mip_chain *chain);
+
+void mip_free(struct mip_chain *chain);
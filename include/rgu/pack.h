@@ -0,0 +1,60 @@
+/* pack.h: packed asset archive
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <rgu/asset.h>
+
+/*
+ * file layout, little endian:
+ *
+ *   struct pack_header
+ *   struct pack_entry[entries], sorted by hash
+ *   normalized paths, '\0' terminated
+ *   payloads, each starts at PACK_ALIGN boundary
+ *
+ * */
+
+#define PACK_MAGIC 0x50554752 /* RGUP */
+#define PACK_VERSION 2
+#define PACK_ALIGN 4096
+#define PACK_MAX 4 /* packs mounted at once */
+
+struct pack_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entries;
+	uint32_t reserved;
+};
+
+struct pack_entry {
+	uint64_t hash; /* pack_hash() of normalized path */
+	uint64_t offset; /* from start of file */
+	uint32_t len;
+	uint32_t name; /* offset of normalized path from start of file */
+};
+
+uint64_t pack_hash(const char *path);
+
+/*
+ * map pack for lifetime of application; get_asset() looks paths up in
+ * mounted packs, newest first, before going to file system; mount and
+ * unmount while no asset is in use
+ *
+ * @ret  1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t pack_mount(const char *path);
+void pack_unmount(void);
+
+/* resolve path inside mounted packs; no syscalls, any thread */
+
+uint8_t pack_find(const char *path, struct asset_info *ainfo);
@@ -0,0 +1,28 @@
+/* pool.h: reusable buffers for decoded assets
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_SLOTS 4
+#define POOL_BYTES (32 << 20) /* keep at most this much idle memory */
+
+/* smallest idle buffer that holds size bytes, or new one; any thread */
+
+uint8_t *pool_take(size_t size, size_t *capacity);
+
+/* keep buffer for next pool_take() or free it; size may be less than
+ * capacity of buffer, never more */
+
+void pool_give(uint8_t *data, size_t size);
+
+/* free idle buffers */
+
+void pool_trim(void);
@@ -0,0 +1,33 @@
+/* prefetch.h: asynchronous asset prefetch
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * bring assets into memory on background i/o thread so that later
+ * get_asset() neither waits for disk nor faults on pages; files of batch
+ * are read with io_uring where kernel allows it, posix_fadvise() otherwise,
+ * then mapped through asset cache with their pages touched; prefetched
+ * assets stay cached while asset budget allows
+ *
+ * @arg paths  copied, need not outlive call
+ * @arg done   called on i/o thread for each path once its pages are
+ *             resident, ok is 0 on failure or prefetch_stop(); may be NULL
+ * @ret        1 if batch is queued, 0 on failure
+ *
+ * */
+
+uint8_t asset_prefetch(const char *const paths[], uint16_t n,
+  const void *amgr, void (*done)(const char *path, uint8_t ok, void *data),
+  void *data);
+
+/* drop queued batches and join i/o thread; call before exit */
+
+void prefetch_stop(void);
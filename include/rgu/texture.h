@@ -0,0 +1,77 @@
+/* texture.h: process wide texture registry
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <rgu/gl.h>
+#include <rgu/asset.h>
+#include <rgu/mip.h>
+#include <rgu/dither.h>
+
+struct texture_stats {
+	uint32_t textures; /* live textures including default one */
+	uint32_t hits;
+	uint32_t misses;
+	uint64_t bytes; /* uploaded texel bytes of live textures */
+};
+
+/* texture formats picked at decode; grey textures go to luminance first,
+ * then opaque ones to etc1, then to 16-bit formats if any is set */
+
+struct texture_policy {
+	uint8_t compress; /* etc1 for opaque textures, raw if driver lacks it */
+	uint8_t opaque_format; /* MIP_RGB565, MIP_RGBA4444 or MIP_RGBA5551 */
+	uint8_t alpha_format; /* MIP_RGBA4444 or MIP_RGBA5551 */
+	uint8_t dither; /* enum dither_mode for 16-bit formats */
+	uint8_t luminance; /* grey textures as luminance (alpha) */
+	const char *cache_dir; /* keep built chains here, NULL to skip */
+};
+
+/* set before any texture is decoded; applies to all later textures */
+
+void texture_set_policy(const struct texture_policy *policy);
+
+/*
+ * decode texture and build its mip chain, compressed and cached according
+ * to policy; gl is not touched so it can run on any thread ahead of
+ * texture_acquire()
+ *
+ * @ret  1 upon success, 0 on failure; chain data is NULL on failure
+ *
+ * */
+
+uint8_t texture_decode(const char *path, const void *amgr,
+  struct mip_chain *chain);
+
+/*
+ * take reference to texture of given path; texture is decoded and uploaded
+ * with its mip chain on first use, NULL path gives shared 1x1 white texture;
+ * call from thread owning gl context
+ *
+ * @arg path   texture path, normalized before lookup
+ * @arg amgr   asset manager to read texture with
+ * @arg chain  mip chain decoded ahead to use on miss, NULL to decode here;
+ *             chain is released in any case
+ * @ret        texture id, default texture if path cannot be loaded
+ *
+ * */
+
+GLuint texture_acquire(const char *path, const void *amgr,
+  struct mip_chain *chain);
+
+/* drop reference; texture is deleted with its last user */
+
+void texture_release(GLuint id);
+
+/* check whether path is already uploaded; safe to call from any thread */
+
+uint8_t texture_cached(const char *path);
+
+void texture_stats(struct texture_stats *stats);
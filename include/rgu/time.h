@@ -66,6 +66,14 @@ static inline uint64_t time_ms(void)
 	return now.tv_sec * 1000 + (uint32_t) (now.tv_nsec * .000001);
 }
 
+static inline uint64_t time_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
 struct timeinfo {
 	uint32_t hh;
 	uint8_t mm;
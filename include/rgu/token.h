@@ -0,0 +1,43 @@
+/* token.h: text tokenizer helpers
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * find end of line
+ *
+ * @arg ptr  start of text
+ * @arg end  end of text
+ * @ret      pointer to '\n' or end if there is no more new lines
+ *
+ * */
+
+const char *tok_eol(const char *ptr, const char *end);
+
+/*
+ * parse number; leading blanks are skipped, locale is not used
+ *
+ * @arg ptr  start of text
+ * @arg end  end of text
+ * @arg val  parsed value
+ * @ret      pointer past the number or NULL if there is no number
+ *
+ * */
+
+const char *tok_float(const char *ptr, const char *end, float *val);
+const char *tok_int(const char *ptr, const char *end, int32_t *val);
+
+static inline const char *tok_skip(const char *ptr, const char *end)
+{
+	while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+		ptr++;
+
+	return ptr;
+}
@@ -17,6 +17,39 @@
 
 #define ARRAY_STRIDE_COLOR 44
 #define ARRAY_STRIDE 32
+#define PACKED_STRIDE_COLOR 20
+#define PACKED_STRIDE 16
+
+struct wfobj_attrib {
+	GLenum type;
+	uint8_t size; /* number of components, 0 if attribute is absent */
+	uint8_t normalized;
+	uint8_t offset; /* bytes from vertex start */
+};
+
+/*
+ * vertex layout of shape array; float layout keeps attributes as is while
+ * packed layout needs shader side decoding:
+ *
+ *   position = pos_bias + pos_scale * position.xyz (int16, [-1, 1])
+ *   normal   = octahedral decode of normal.xy (int16, [-1, 1])
+ *   uv       = uv_bias + uv_scale * uv.xy (uint16, [0, 1])
+ *   color    = color.rgb (uint8, [0, 1])
+ *
+ * */
+
+struct wfobj_layout {
+	uint8_t packed;
+	uint8_t stride; /* bytes */
+	struct wfobj_attrib position;
+	struct wfobj_attrib normal;
+	struct wfobj_attrib uv;
+	struct wfobj_attrib color;
+	float pos_scale[3];
+	float pos_bias[3];
+	float uv_scale[2];
+	float uv_bias[2];
+};
 
 struct wfobj {
 	uint16_t id;
@@ -26,13 +59,18 @@ struct wfobj {
 	GLuint tex;
 	char *texname;
 
-	GLuint ibo;
-	uint16_t *indices;
+	GLuint ibo; /* shared by all model shapes */
+	uint32_t indices_offset; /* bytes into ibo */
+	void *indices; /* uint16_t or uint32_t as per indices_type */
 	uint32_t indices_num;
+	GLenum indices_type; /* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
 
-	GLuint vbo;
-	float *array;
-	uint32_t array_size;
+	GLuint vbo; /* shared by all model shapes */
+	uint32_t array_offset; /* bytes into vbo, add to attribute offsets */
+	void *array; /* interleaved vertices as per layout */
+	uint32_t array_size; /* bytes */
+	uint32_t vertices_num;
+	struct wfobj_layout layout;
 	uint8_t with_color;
 	union color_rgb color; /* voxel object color */
 
@@ -42,13 +80,59 @@ struct wfobj {
 struct model {
 	char *name;
 	struct list_head shapes;
+	GLuint vbo;
+	GLuint ibo;
 	union color_rgb rgb; /* if all planes are >= 0 then ignore mtl and use this color */
 	union gm_point3 min;
 	union gm_point3 max;
 	uint8_t ignore_texture;
+	uint8_t threads; /* parser threads; 0 or 1 to parse on calling thread */
+	uint8_t optimize; /* reorder triangles and vertices for gpu caches */
+	uint8_t pack; /* quantize vertex attributes, see struct wfobj_layout */
+	uint8_t lazy_textures; /* upload with placeholder, see model_update_textures() */
+	uint16_t atlas; /* pack small textures into atlases of this size; 0 to disable */
+	const char *cache_dir; /* where to keep cooked models; NULL to disable */
 	void *ctx; /* privately owned context */
 };
 
 uint8_t prepare_model(char *path, struct model *model, void *amgr);
 void upload_model(struct model *model);
 void erase_model(struct model *model);
+
+/*
+ * incremental alternative to prepare_model() plus upload_model(); loader
+ * state is kept in model context and each step runs units of work (parser
+ * chunk, shape, shape upload) until time budget is spent; steps must be
+ * called from thread owning gl context
+ *
+ * @arg budget_us  time budget of one step, at least one unit is always run
+ * @ret            1 upon success, 0 on failure; model is erased on failure
+ *
+ * */
+
+uint8_t model_load_begin(char *path, struct model *model, void *amgr);
+uint8_t model_load_step(struct model *model, uint32_t budget_us);
+uint8_t model_load_done(const struct model *model);
+
+/*
+ * same as model_load_step() but stops once model is prepared and textures
+ * are decoded; never touches gl so it can run on any thread
+ *
+ * */
+
+uint8_t model_prepare_step(struct model *model, uint32_t budget_us);
+
+/* cpu side preparation progress in percents */
+
+uint8_t model_load_progress(const struct model *model);
+
+/*
+ * with model->lazy_textures set upload_model() binds shapes to 1x1 default
+ * texture and decodes their textures in background; call this from gl
+ * thread every frame to swap decoded textures into wfobj::tex
+ *
+ * @ret  number of shapes which got their texture by this call
+ *
+ * */
+
+uint16_t model_update_textures(struct model *model);
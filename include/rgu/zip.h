@@ -0,0 +1,37 @@
+/* zip.h: assets inside zip and apk archives
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <rgu/asset.h>
+
+#define ZIP_MAX 4 /* archives mounted at once */
+
+/*
+ * map archive and index its central directory for lifetime of
+ * application; get_asset() looks paths up in mounted archives after packs
+ * and before file system; on android apk path is in
+ * ApplicationInfo.sourceDir; mount and unmount while no asset is in use
+ *
+ * @ret  1 upon success, 0 on failure
+ *
+ * */
+
+uint8_t zip_mount(const char *path);
+void zip_unmount(void);
+
+/*
+ * resolve path inside mounted archives; stored entries point straight
+ * into mapping, deflated ones are inflated into pooled buffer which
+ * put_asset() gives back; any thread
+ *
+ * */
+
+uint8_t zip_find(const char *path, struct asset_info *ainfo);
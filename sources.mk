@@ -6,5 +6,19 @@ $(rgudir)/src/color.c \
 $(rgudir)/src/audio.c \
 $(rgudir)/src/wfobj.c \
 $(rgudir)/src/asset.c \
+$(rgudir)/src/token.c \
+$(rgudir)/src/cook.c \
+$(rgudir)/src/mesh.c \
+$(rgudir)/src/async.c \
+$(rgudir)/src/texture.c \
+$(rgudir)/src/mip.c \
+$(rgudir)/src/etc.c \
+$(rgudir)/src/atlas.c \
+$(rgudir)/src/dither.c \
+$(rgudir)/src/decoder.c \
+$(rgudir)/src/pack.c \
+$(rgudir)/src/pool.c \
+$(rgudir)/src/zip.c \
+$(rgudir)/src/prefetch.c \
 
 #$(rgudir)/src/sensors.c \
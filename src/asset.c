@@ -10,16 +10,48 @@
 #include <android/asset_manager_jni.h>
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <rgu/stb_image.h>
 #include <rgu/log.h>
+#include <rgu/list.h>
 #include <rgu/asset.h>
+#include <rgu/decoder.h>
+#include <rgu/pack.h>
+#include <rgu/pool.h>
+#include <rgu/zip.h>
+
+#define BUCKETS 256 /* power of two */
+
+/* assets shared by path; idle ones stay resident in lru order until
+ * budget is exceeded */
+
+struct cached_asset {
+	struct asset_info ainfo;
+	uint32_t refs;
+	struct cached_asset *next; /* bucket chain */
+	struct list_head lru; /* idle assets, least recently used first */
+	char path[]; /* normalized */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct cached_asset *buckets[BUCKETS];
+	struct list_head lru;
+	size_t budget;
+	struct asset_stats stats;
+} cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.lru = { &cache.lru, &cache.lru },
+	.budget = ASSET_BUDGET,
+};
 
 static void unmap_asset(struct asset_info *ainfo)
 {
@@ -34,52 +66,129 @@ static void unmap_asset(struct asset_info *ainfo)
 	}
 }
 
+/* drop empty and "." segments and fold ".." so that equal files share one
+ * key; symlinks are not resolved */
+
+void normalize_path(const char *path, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (path[0] == '/')
+		buf[len++] = '/';
+
+	size_t base = len;
+	size_t up = len; /* end of leading ".." segments, they cannot fold */
+
+	while (*path) {
+		while (*path == '/')
+			path++;
+
+		const char *seg = path;
+
+		while (*path && *path != '/')
+			path++;
+
+		size_t seg_len = path - seg;
+		uint8_t parent = seg_len == 2 && seg[0] == '.' && seg[1] == '.';
+
+		if (!seg_len || (seg_len == 1 && seg[0] == '.')) {
+			continue;
+		} else if (parent && len > up) {
+			while (len > base && buf[len - 1] != '/')
+				len--;
+
+			if (len > base)
+				len--; /* separator */
+
+			continue;
+		} else if (parent && base) {
+			continue; /* nothing above root */
+		} else if (len + 1 + seg_len + 1 > size) {
+			break;
+		}
+
+		if (len > base)
+			buf[len++] = '/';
+
+		memcpy(buf + len, seg, seg_len);
+		len += seg_len;
+
+		if (parent)
+			up = len;
+	}
+
+	buf[len] = '\0';
+}
+
+/* parsers never write into asset memory, so file stays in shared page
+ * cache instead of being copied on write page by page */
+
 static uint8_t map_asset(const char *path, struct asset_info *ainfo)
 {
 	struct stat st;
 
 	ainfo->buf = NULL;
+	ainfo->asset = NULL;
 	ainfo->fd = -1;
+	ainfo->source = ASSET_FILE;
 
 	if (stat(path, &st) < 0 || S_ISDIR(st.st_mode)) {
 		ee("failed to get file size | path '%s'\n", path);
 		return 0;
+	} else if (st.st_size == 0 || st.st_size > UINT32_MAX) {
+		ee("unsupported file size %lld | path '%s'\n",
+		  (long long) st.st_size, path);
+		return 0;
 	}
 
-	if ((ainfo->fd = open(path, O_RDWR)) < 0) {
+	if ((ainfo->fd = open(path, O_RDONLY)) < 0) {
 		ee("failed to open file '%s'\n", path);
 		return 0;
 	}
 
-	uint32_t prot = PROT_READ | PROT_WRITE;
-	uint32_t flags = MAP_PRIVATE;
+	void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, ainfo->fd, 0);
 
-	ainfo->buf = (unsigned char *) mmap(NULL, st.st_size, prot, flags,
-	  ainfo->fd, 0);
+	close(ainfo->fd); /* mapping keeps file, cached assets hold no fds */
+	ainfo->fd = -1;
 
-	if (!ainfo->buf) {
+	if (buf == MAP_FAILED) {
 		ee("failed to map file %s\n", path);
-		close(ainfo->fd);
-		ainfo->fd = -1;
 		return 0;
 	}
 
+	ainfo->buf = (const unsigned char *) buf;
 	ainfo->len = st.st_size;
 	return 1;
 }
 
+/* underlying asset is released once cache lets it go */
 
-void put_asset(struct asset_info *ainfo)
+static void release_asset(struct asset_info *ainfo)
 {
+	if (ainfo->source == ASSET_PACK || ainfo->source == ASSET_ZIP) {
+		ainfo->buf = NULL;
+		return;
+	} else if (ainfo->source == ASSET_INFLATED) {
+		pool_give((uint8_t *) ainfo->buf, ainfo->capacity);
+		ainfo->buf = NULL;
+		return;
+	}
+
 #ifdef ANDROID
-	AAsset_close((AAsset *) ainfo->asset);
-#else
-	unmap_asset(ainfo);
+	if (ainfo->source == ASSET_ANDROID) {
+		AAsset_close((AAsset *) ainfo->asset);
+		return;
+	}
 #endif
+	unmap_asset(ainfo);
 }
 
-uint8_t get_asset(const char *path, struct asset_info *ainfo, const void *amgr)
+static uint8_t load_asset(const char *path, struct asset_info *ainfo,
+  const void *amgr)
 {
+	if (zip_find(path, ainfo))
+		return 1;
+
 #ifdef ANDROID
 	if (amgr) {
 		AAsset *asset = AAssetManager_open((AAssetManager *) amgr,
@@ -93,6 +202,8 @@ uint8_t get_asset(const char *path, struct asset_info *ainfo, const void *amgr)
 		ainfo->buf = AAsset_getBuffer(asset);
 		ainfo->len = AAsset_getLength(asset);
 		ainfo->asset = asset;
+		ainfo->fd = -1;
+		ainfo->source = ASSET_ANDROID;
 
 		return 1;
 	}
@@ -101,19 +212,244 @@ uint8_t get_asset(const char *path, struct asset_info *ainfo, const void *amgr)
 	return map_asset(path, ainfo);
 }
 
+static inline uint32_t path_hash(const char *path)
+{
+	uint32_t h = 2166136261u; /* fnv-1a */
+
+	while (*path)
+		h = (h ^ (uint8_t) *path++) * 16777619u;
+
+	return h & (BUCKETS - 1);
+}
+
+static struct cached_asset *find_cached(const char *path)
+{
+	struct cached_asset *entry = cache.buckets[path_hash(path)];
+
+	for (; entry; entry = entry->next) {
+		if (strcmp(entry->path, path) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void unlink_cached(struct cached_asset *entry)
+{
+	struct cached_asset **ptr = &cache.buckets[path_hash(entry->path)];
+
+	while (*ptr != entry)
+		ptr = &(*ptr)->next;
+
+	*ptr = entry->next;
+	list_del(&entry->lru);
+	cache.stats.assets--;
+	cache.stats.idle--;
+	cache.stats.resident -= entry->ainfo.len;
+}
+
+/* detach least recently used idle assets until resident bytes fit limit;
+ * call locked, release returned chain unlocked */
+
+static struct cached_asset *evict_idle(size_t limit)
+{
+	struct cached_asset *evicted = NULL;
+
+	while (cache.stats.resident > limit && !list_empty(&cache.lru)) {
+		struct cached_asset *entry = container_of(cache.lru.next,
+		  struct cached_asset, lru);
+
+		unlink_cached(entry);
+		entry->next = evicted;
+		evicted = entry;
+		cache.stats.evictions++;
+	}
+
+	return evicted;
+}
+
+static void release_evicted(struct cached_asset *entry)
+{
+	while (entry) {
+		struct cached_asset *next = entry->next;
+
+		dd("evict %s\n", entry->path);
+		release_asset(&entry->ainfo);
+		free(entry);
+		entry = next;
+	}
+}
+
+static void use_cached(struct cached_asset *entry, struct asset_info *ainfo)
+{
+	if (entry->refs++ == 0) {
+		list_del(&entry->lru);
+		cache.stats.idle--;
+	}
+
+	ainfo->buf = entry->ainfo.buf;
+	ainfo->len = entry->ainfo.len;
+	ainfo->asset = entry;
+	ainfo->fd = -1;
+	ainfo->source = ASSET_CACHED;
+}
+
+void put_asset(struct asset_info *ainfo)
+{
+	if (ainfo->source != ASSET_CACHED) {
+		release_asset(ainfo);
+		return;
+	}
+
+	struct cached_asset *entry = (struct cached_asset *) ainfo->asset;
+	struct cached_asset *evicted = NULL;
+
+	pthread_mutex_lock(&cache.lock);
+
+	if (--entry->refs == 0) {
+		list_add(&cache.lru, &entry->lru);
+		cache.stats.idle++;
+		evicted = evict_idle(cache.budget);
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+	release_evicted(evicted);
+
+	ainfo->buf = NULL;
+	ainfo->asset = NULL;
+}
+
+uint8_t get_asset(const char *path, struct asset_info *ainfo, const void *amgr)
+{
+	struct cached_asset *entry;
+	struct cached_asset *found;
+	char key[PATH_MAX];
+
+	if (pack_find(path, ainfo))
+		return 1; /* nothing to share, pack is mapped for good */
+
+	normalize_path(path, key, sizeof(key));
+	pthread_mutex_lock(&cache.lock);
+
+	if ((entry = find_cached(key))) {
+		use_cached(entry, ainfo);
+		cache.stats.hits++;
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	if (entry)
+		return 1;
+	else if (!load_asset(path, ainfo, amgr))
+		return 0;
+	else if (ainfo->source == ASSET_ZIP)
+		return 1; /* points into mounted archive, nothing to share */
+
+	size_t len = strlen(key) + 1;
+
+	if (!(entry = calloc(1, sizeof(*entry) + len))) {
+		ww("failed to cache %s\n", key);
+		return 1; /* caller still gets asset of its own */
+	}
+
+	memcpy(entry->path, key, len);
+	entry->ainfo = *ainfo;
+
+	pthread_mutex_lock(&cache.lock);
+
+	if ((found = find_cached(key))) { /* another thread was faster */
+		use_cached(found, ainfo);
+		cache.stats.hits++;
+	} else {
+		uint32_t bucket = path_hash(key);
+
+		entry->next = cache.buckets[bucket];
+		cache.buckets[bucket] = entry;
+		cache.stats.assets++;
+		cache.stats.misses++;
+		cache.stats.resident += entry->ainfo.len;
+		list_init(&entry->lru);
+		cache.stats.idle++; /* use_cached() takes it out of lru */
+		use_cached(entry, ainfo);
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	if (found) {
+		release_asset(&entry->ainfo);
+		free(entry);
+	}
+
+	return 1;
+}
+
+void asset_set_budget(size_t bytes)
+{
+	struct cached_asset *evicted;
+
+	pthread_mutex_lock(&cache.lock);
+	cache.budget = bytes;
+	evicted = evict_idle(cache.budget);
+	pthread_mutex_unlock(&cache.lock);
+
+	release_evicted(evicted);
+}
+
+void asset_trim(uint8_t level)
+{
+	struct cached_asset *evicted;
+
+	pthread_mutex_lock(&cache.lock);
+	evicted = evict_idle(0);
+
+	/* pages of file mappings come back from page cache on next access */
+
+	for (uint32_t i = 0; level == ASSET_TRIM_ALL && i < BUCKETS; ++i) {
+		struct cached_asset *entry = cache.buckets[i];
+
+		for (; entry; entry = entry->next) {
+			if (entry->ainfo.source == ASSET_FILE)
+				madvise((void *) entry->ainfo.buf,
+				  entry->ainfo.len, MADV_DONTNEED);
+		}
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	release_evicted(evicted);
+	pool_trim();
+}
+
+void asset_stats(struct asset_stats *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* kept for older users, see image_decode() */
+
 void put_image(struct image_info *iinfo)
 {
-	stbi_image_free(iinfo->image);
+	free(iinfo->image);
 	iinfo->image = NULL;
 }
 
 uint8_t get_image(struct asset_info *ainfo, struct image_info *iinfo)
 {
-	iinfo->image = stbi_load_from_memory(ainfo->buf, ainfo->len,
-	  &iinfo->w, &iinfo->h, &iinfo->planes, STBI_default);
+	struct image image;
+
+	iinfo->image = NULL;
 
-	if (!iinfo->image)
+	if (!image_decode(ainfo, &image))
 		return 0;
 
+	iinfo->image = image.data;
+	iinfo->w = image.w;
+	iinfo->h = image.h;
+	iinfo->planes = image.format == GL_LUMINANCE ? 1 :
+	  (image.format == GL_LUMINANCE_ALPHA ? 2 :
+	  (image.format == GL_RGB ? 3 : 4));
+
 	return 1;
 }
@@ -0,0 +1,295 @@
+/* async.c: background model loading
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define TAG "async"
+
+#include <rgu/log.h>
+#include <rgu/list.h>
+#include <rgu/time.h>
+#include <rgu/async.h>
+
+struct async_job {
+	struct async_request req;
+	atomic_uchar cancel;
+	uint8_t started; /* model state is only ours once loading began */
+	uint8_t ok;
+	struct async_job *next; /* completion queue link */
+	struct list_head head; /* pending or uploading list */
+};
+
+#define job_item(item) container_of(item, struct async_job, head)
+
+struct async_loader {
+	pthread_t *threads;
+	uint8_t threads_num;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head pending; /* protected by lock */
+	uint8_t stop; /* protected by lock */
+	_Atomic(struct async_job *) completed; /* lock-free stack */
+	struct list_head uploading; /* gl thread only */
+};
+
+/* many workers push, gl thread takes whole stack at once */
+
+static void post_job(struct async_loader *loader, struct async_job *job)
+{
+	struct async_job *top = atomic_load_explicit(&loader->completed,
+	  memory_order_relaxed);
+
+	do {
+		job->next = top;
+	} while (!atomic_compare_exchange_weak_explicit(&loader->completed,
+	  &top, job, memory_order_release, memory_order_relaxed));
+}
+
+static struct async_job *take_jobs(struct async_loader *loader)
+{
+	struct async_job *job = atomic_exchange_explicit(&loader->completed,
+	  NULL, memory_order_acquire);
+	struct async_job *res = NULL;
+
+	while (job) { /* reverse to completion order */
+		struct async_job *next = job->next;
+
+		job->next = res;
+		res = job;
+		job = next;
+	}
+
+	return res;
+}
+
+static inline uint8_t cancelled(struct async_job *job)
+{
+	return atomic_load_explicit(&job->cancel, memory_order_relaxed);
+}
+
+static void prepare_job(struct async_job *job)
+{
+	struct model *model = job->req.model;
+	uint8_t percent = 0;
+
+	if (cancelled(job))
+		return;
+
+	job->started = 1;
+
+	if (!model_load_begin(job->req.path, model, job->req.amgr))
+		return;
+
+	while (model_load_progress(model) < 100) {
+		if (cancelled(job) || !model_prepare_step(model, 0))
+			return;
+
+		uint8_t cur = model_load_progress(model);
+
+		if (job->req.progress && cur != percent)
+			job->req.progress(model, cur, job->req.data);
+
+		percent = cur;
+	}
+
+	job->ok = 1;
+}
+
+static void *worker(void *arg)
+{
+	struct async_loader *loader = arg;
+
+	while (1) {
+		pthread_mutex_lock(&loader->lock);
+
+		while (!loader->stop && list_empty(&loader->pending))
+			pthread_cond_wait(&loader->cond, &loader->lock);
+
+		if (loader->stop) {
+			pthread_mutex_unlock(&loader->lock);
+			break;
+		}
+
+		struct async_job *job = job_item(loader->pending.next);
+
+		list_del(&job->head);
+		pthread_mutex_unlock(&loader->lock);
+
+		prepare_job(job);
+		post_job(loader, job);
+	}
+
+	return NULL;
+}
+
+struct async_loader *async_start(uint8_t workers)
+{
+	struct async_loader *loader = calloc(1, sizeof(*loader));
+
+	workers = workers ? workers : 1;
+
+	if (!loader || !(loader->threads = calloc(workers, sizeof(pthread_t)))) {
+		ee("failed to allocate async loader\n");
+		free(loader);
+		return NULL;
+	}
+
+	pthread_mutex_init(&loader->lock, NULL);
+	pthread_cond_init(&loader->cond, NULL);
+	list_init(&loader->pending);
+	list_init(&loader->uploading);
+	atomic_init(&loader->completed, NULL);
+
+	for (uint8_t i = 0; i < workers; ++i) {
+		if (pthread_create(&loader->threads[i], NULL, worker,
+		  loader) != 0) {
+			ee("failed to start worker %u\n", i);
+			break;
+		}
+
+		loader->threads_num++;
+	}
+
+	if (!loader->threads_num) {
+		async_stop(loader);
+		return NULL;
+	}
+
+	ii("started %u workers\n", loader->threads_num);
+
+	return loader;
+}
+
+static void finish_job(struct async_job *job, uint8_t ok)
+{
+	struct model *model = job->req.model;
+
+	if (!ok && job->started && model->ctx)
+		erase_model(model);
+
+	if (job->req.done)
+		job->req.done(model, ok, job->req.data);
+
+	free(job);
+}
+
+void async_stop(struct async_loader *loader)
+{
+	struct list_head *cur;
+	struct list_head *tmp;
+
+	pthread_mutex_lock(&loader->lock);
+	loader->stop = 1;
+	pthread_cond_broadcast(&loader->cond);
+	pthread_mutex_unlock(&loader->lock);
+
+	for (uint8_t i = 0; i < loader->threads_num; ++i)
+		pthread_join(loader->threads[i], NULL);
+
+	list_walk_safe(cur, tmp, &loader->pending) {
+		list_del(cur);
+		finish_job(job_item(cur), 0);
+	}
+
+	for (struct async_job *job = take_jobs(loader); job; ) {
+		struct async_job *next = job->next;
+
+		finish_job(job, 0);
+		job = next;
+	}
+
+	list_walk_safe(cur, tmp, &loader->uploading) {
+		list_del(cur);
+		finish_job(job_item(cur), 0);
+	}
+
+	pthread_cond_destroy(&loader->cond);
+	pthread_mutex_destroy(&loader->lock);
+	free(loader->threads);
+	free(loader);
+}
+
+struct async_job *async_load(struct async_loader *loader,
+  const struct async_request *req)
+{
+	struct async_job *job = calloc(1, sizeof(*job));
+
+	if (!job) {
+		ee("failed to allocate job for %s\n", req->path);
+		return NULL;
+	}
+
+	job->req = *req;
+	atomic_init(&job->cancel, 0);
+
+	pthread_mutex_lock(&loader->lock);
+	list_add(&loader->pending, &job->head);
+	pthread_cond_signal(&loader->cond);
+	pthread_mutex_unlock(&loader->lock);
+
+	return job;
+}
+
+void async_cancel(struct async_job *job)
+{
+	atomic_store_explicit(&job->cancel, 1, memory_order_relaxed);
+}
+
+uint16_t async_complete(struct async_loader *loader, uint32_t budget_us)
+{
+	uint64_t start = time_us();
+	uint16_t num = 0;
+
+	for (struct async_job *job = take_jobs(loader); job; ) {
+		struct async_job *next = job->next;
+
+		if (!job->ok || cancelled(job)) {
+			finish_job(job, 0);
+			num++;
+		} else {
+			list_add(&loader->uploading, &job->head);
+		}
+
+		job = next;
+	}
+
+	for (uint8_t stepped = 0; !list_empty(&loader->uploading); ) {
+		struct async_job *job = job_item(loader->uploading.next);
+		struct model *model = job->req.model;
+		uint64_t spent = time_us() - start;
+
+		if (cancelled(job)) {
+			list_del(&job->head);
+			finish_job(job, 0);
+			num++;
+			continue;
+		} else if (stepped && spent >= budget_us) {
+			break;
+		}
+
+		/* first step is always run, even with budget spent on drain */
+
+		uint32_t left = spent < budget_us ? budget_us - spent : 0;
+
+		stepped = 1;
+
+		if (!model_load_step(model, left)) {
+			list_del(&job->head);
+			finish_job(job, 0);
+			num++;
+		} else if (model_load_done(model)) {
+			list_del(&job->head);
+			finish_job(job, 1);
+			num++;
+		}
+	}
+
+	return num;
+}
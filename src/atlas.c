@@ -0,0 +1,170 @@
+/* atlas.c: texture atlas packing
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "atlas"
+
+#include <rgu/log.h>
+#include <rgu/atlas.h>
+
+uint8_t atlas_init(struct atlas *atlas, uint16_t w, uint16_t h)
+{
+	memset(atlas, 0, sizeof(*atlas));
+
+	atlas->nodes_max = w / ATLAS_ALIGN + 1;
+
+	if (!(atlas->nodes = calloc(atlas->nodes_max, sizeof(*atlas->nodes)))) {
+		ee("failed to allocate %u atlas nodes\n", atlas->nodes_max);
+		return 0;
+	}
+
+	atlas->w = w;
+	atlas->h = h;
+	atlas->nodes[0].w = w;
+	atlas->nodes_num = 1;
+
+	return 1;
+}
+
+void atlas_release(struct atlas *atlas)
+{
+	free(atlas->nodes);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+/* height rect would sit at if placed at node i, -1 if it does not fit */
+
+static int32_t fit_at(const struct atlas *atlas, uint16_t i, uint16_t w,
+  uint16_t h)
+{
+	uint16_t x = atlas->nodes[i].x;
+	int32_t y = 0;
+	int32_t left = w;
+
+	if (x + w > atlas->w)
+		return -1;
+
+	for (; left > 0 && i < atlas->nodes_num; ++i) {
+		if (atlas->nodes[i].y > y)
+			y = atlas->nodes[i].y;
+
+		if (y + h > atlas->h)
+			return -1;
+
+		left -= atlas->nodes[i].w;
+	}
+
+	return y;
+}
+
+static void remove_node(struct atlas *atlas, uint16_t i)
+{
+	memmove(&atlas->nodes[i], &atlas->nodes[i + 1],
+	  (atlas->nodes_num - i - 1) * sizeof(*atlas->nodes));
+	atlas->nodes_num--;
+}
+
+uint8_t atlas_pack(struct atlas *atlas, uint16_t w, uint16_t h, uint16_t *x,
+  uint16_t *y)
+{
+	int32_t best_top = INT32_MAX;
+	int32_t best = -1;
+	uint16_t best_y = 0;
+
+	w = (w + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1);
+	h = (h + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1);
+
+	for (uint16_t i = 0; i < atlas->nodes_num; ++i) {
+		int32_t top = fit_at(atlas, i, w, h);
+
+		if (top >= 0 && top + h < best_top) {
+			best_top = top + h;
+			best_y = top;
+			best = i;
+		}
+	}
+
+	if (best < 0 || atlas->nodes_num == atlas->nodes_max)
+		return 0;
+
+	struct atlas_node *node = &atlas->nodes[best];
+
+	memmove(node + 1, node, (atlas->nodes_num - best) * sizeof(*node));
+	atlas->nodes_num++;
+	*x = node->x;
+	*y = best_y;
+	node->y = best_y + h;
+	node->w = w;
+
+	/* trim nodes now covered by new one */
+
+	for (uint16_t i = best + 1; i < atlas->nodes_num; ) {
+		struct atlas_node *prev = &atlas->nodes[i - 1];
+		struct atlas_node *cur = &atlas->nodes[i];
+		uint16_t end = prev->x + prev->w;
+
+		if (cur->x >= end)
+			break;
+
+		if (cur->x + cur->w <= end) {
+			remove_node(atlas, i);
+			continue;
+		}
+
+		cur->w -= end - cur->x;
+		cur->x = end;
+		break;
+	}
+
+	for (uint16_t i = 0; i + 1 < atlas->nodes_num; ) {
+		if (atlas->nodes[i].y == atlas->nodes[i + 1].y) {
+			atlas->nodes[i].w += atlas->nodes[i + 1].w;
+			remove_node(atlas, i + 1);
+		} else {
+			++i;
+		}
+	}
+
+	if (atlas->used_h < best_y + h)
+		atlas->used_h = best_y + h;
+
+	return 1;
+}
+
+void atlas_blit(uint8_t *dst, uint16_t dw, uint8_t dplanes,
+  const uint8_t *src, uint16_t sw, uint16_t sh, uint8_t splanes,
+  uint16_t x, uint16_t y, uint8_t pad)
+{
+	/* atlas_pack() reserved whole aligned rect, clamp into its remainder
+	 * too instead of leaving black filler for mip levels to pick up */
+	int32_t rows = ((sh + 2 * pad + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1)) -
+	  pad;
+	int32_t cols = ((sw + 2 * pad + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1)) -
+	  pad;
+
+	for (int32_t row = -pad; row < rows; ++row) {
+		int32_t sy = row < 0 ? 0 : (row >= sh ? sh - 1 : row);
+		const uint8_t *line = src + (size_t) sy * sw * splanes;
+		uint8_t *out = dst + ((size_t) (y + pad + row) * dw + x) *
+		  dplanes;
+
+		for (int32_t col = -pad; col < cols; ++col) {
+			int32_t sx = col < 0 ? 0 : (col >= sw ? sw - 1 : col);
+			const uint8_t *texel = line + sx * splanes;
+
+			memcpy(out, texel, 3);
+
+			if (dplanes == 4)
+				out[3] = splanes == 4 ? texel[3] : 0xff;
+
+			out += dplanes;
+		}
+	}
+}
@@ -0,0 +1,382 @@
+/* cook.c: binary cache of prepared models
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TAG "cook"
+
+#include <rgu/log.h>
+#include <rgu/utils.h>
+#include <rgu/cook.h>
+
+#define COOK_MAGIC 0x4d554752 /* RGUM */
+#define COOK_VERSION 2
+#define COOK_ALIGN 16
+
+struct cook_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	float min[3];
+	float max[3];
+	uint32_t shapes_num;
+	uint32_t reserved;
+	uint64_t size;
+};
+
+struct cook_shape {
+	uint64_t name;
+	uint64_t texname;
+	uint64_t array;
+	uint64_t indices;
+	uint32_t array_size;
+	uint32_t vertices_num;
+	uint32_t indices_num;
+	uint32_t indices_type;
+	float color[3];
+	uint8_t with_color;
+	uint8_t visible;
+	uint8_t reserved[2];
+	struct wfobj_layout layout;
+};
+
+#define align(val) (((val) + COOK_ALIGN - 1) & ~((uint64_t) COOK_ALIGN - 1))
+
+static inline uint64_t rotl(uint64_t val, uint8_t n)
+{
+	return (val << n) | (val >> (64 - n));
+}
+
+static inline uint64_t mix(uint64_t h, uint64_t val)
+{
+	return rotl(h ^ (val * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+}
+
+/* four independent lanes keep multipliers busy on big assets */
+
+uint64_t cook_hash(const void *buf, size_t len, uint64_t seed)
+{
+	const uint8_t *ptr = buf;
+	const uint8_t *end = ptr + len;
+	uint64_t h[4] = { seed, seed + 1, seed + 2, seed + 3 };
+	uint64_t val;
+
+	while (end - ptr >= 32) {
+		for (uint8_t i = 0; i < 4; ++i) {
+			memcpy(&val, ptr + i * 8, sizeof(val));
+			h[i] = mix(h[i], val);
+		}
+
+		ptr += 32;
+	}
+
+	uint64_t res = rotl(h[0], 1) + rotl(h[1], 7) + rotl(h[2], 12) +
+	  rotl(h[3], 18);
+
+	while (end - ptr >= 8) {
+		memcpy(&val, ptr, sizeof(val));
+		res = mix(res, val);
+		ptr += 8;
+	}
+
+	val = 0;
+	memcpy(&val, ptr, end - ptr);
+	res = mix(res, val) ^ len;
+
+	res ^= res >> 33; /* murmur3 finalizer */
+	res *= 0xff51afd7ed558ccdULL;
+	res ^= res >> 33;
+	res *= 0xc4ceb9fe1a85ec53ULL;
+	res ^= res >> 33;
+
+	return res;
+}
+
+static inline uint8_t index_size(const struct wfobj *shape)
+{
+	return shape->indices_type == GL_UNSIGNED_INT ? sizeof(uint32_t) :
+	  sizeof(uint16_t);
+}
+
+static uint8_t write_blob(FILE *fp, const void *buf, size_t len, uint64_t off)
+{
+	static const uint8_t zero[COOK_ALIGN];
+	long pos = ftell(fp);
+
+	if (pos < 0 || (uint64_t) pos > off)
+		return 0;
+	else if (off - pos && fwrite(zero, 1, off - pos, fp) != off - pos)
+		return 0;
+	else if (len && fwrite(buf, 1, len, fp) != len)
+		return 0;
+
+	return 1;
+}
+
+uint8_t cook_save(const char *path, uint64_t key, struct model *model)
+{
+	struct list_head *cur;
+	struct cook_header hdr = {0};
+	struct cook_shape *shapes;
+	char tmp[PATH_MAX];
+	uint32_t i = 0;
+	FILE *fp;
+
+	list_walk(cur, &model->shapes)
+		hdr.shapes_num++;
+
+	if (!(shapes = calloc(hdr.shapes_num + 1, sizeof(*shapes)))) {
+		ee("failed to allocate %u cooked shapes\n", hdr.shapes_num);
+		return 0;
+	}
+
+	uint64_t off = sizeof(hdr) + hdr.shapes_num * sizeof(*shapes);
+
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct cook_shape *cs = &shapes[i++];
+
+		cs->name = off;
+		off += strlen(shape->name) + 1;
+
+		if (shape->texname) {
+			cs->texname = off;
+			off += strlen(shape->texname) + 1;
+		}
+
+		cs->array = off = align(off);
+		off += shape->array_size;
+		cs->indices = off = align(off);
+		off += (uint64_t) shape->indices_num * index_size(shape);
+
+		cs->array_size = shape->array_size;
+		cs->vertices_num = shape->vertices_num;
+		cs->indices_num = shape->indices_num;
+		cs->indices_type = shape->indices_type;
+		cs->with_color = shape->with_color;
+		cs->visible = shape->visible;
+		cs->layout = shape->layout;
+		memcpy(cs->color, shape->color.data, sizeof(cs->color));
+	}
+
+	hdr.magic = COOK_MAGIC;
+	hdr.version = COOK_VERSION;
+	hdr.key = key;
+	hdr.size = off;
+	memcpy(hdr.min, model->min.data, sizeof(hdr.min));
+	memcpy(hdr.max, model->max.data, sizeof(hdr.max));
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	if (!(fp = fopen(tmp, "wb"))) {
+		ee("failed to create %s\n", tmp);
+		free(shapes);
+		return 0;
+	}
+
+	uint8_t ret = write_blob(fp, &hdr, sizeof(hdr), 0) &&
+	  write_blob(fp, shapes, hdr.shapes_num * sizeof(*shapes), sizeof(hdr));
+
+	i = 0;
+
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct cook_shape *cs = &shapes[i++];
+
+		if (!ret)
+			break;
+
+		ret = write_blob(fp, shape->name, strlen(shape->name) + 1,
+		  cs->name);
+
+		if (ret && shape->texname)
+			ret = write_blob(fp, shape->texname,
+			  strlen(shape->texname) + 1, cs->texname);
+
+		ret = ret && write_blob(fp, shape->array, shape->array_size,
+		  cs->array);
+		ret = ret && write_blob(fp, shape->indices,
+		  (size_t) shape->indices_num * index_size(shape), cs->indices);
+	}
+
+	free(shapes);
+
+	if (fclose(fp) != 0 || !ret || rename(tmp, path) < 0) {
+		ee("failed to write %s\n", path);
+		unlink(tmp);
+		return 0;
+	}
+
+	ii("cooked %u shapes to %s | %zu bytes\n", hdr.shapes_num, path,
+	  (size_t) hdr.size);
+
+	return 1;
+}
+
+void cook_unmap(struct cooked *cooked)
+{
+	if (cooked->buf)
+		munmap((void *) cooked->buf, cooked->len);
+
+	cooked->buf = NULL;
+	cooked->len = 0;
+}
+
+static uint8_t check_indices(const struct cook_shape *cs, const uint8_t *buf)
+{
+	if (cs->indices_type == GL_UNSIGNED_INT) {
+		const uint32_t *indices = (const void *) (buf + cs->indices);
+
+		for (uint32_t i = 0; i < cs->indices_num; ++i) {
+			if (indices[i] >= cs->vertices_num)
+				return 0;
+		}
+	} else {
+		const uint16_t *indices = (const void *) (buf + cs->indices);
+
+		for (uint32_t i = 0; i < cs->indices_num; ++i) {
+			if (indices[i] >= cs->vertices_num)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t check_shape(const struct cook_shape *cs, const uint8_t *buf,
+  size_t len)
+{
+	uint8_t isize = cs->indices_type == GL_UNSIGNED_INT ? 4 : 2;
+
+	if (cs->indices_type != GL_UNSIGNED_INT &&
+	  cs->indices_type != GL_UNSIGNED_SHORT)
+		return 0;
+	else if (cs->array_size !=
+	  (uint64_t) cs->vertices_num * cs->layout.stride)
+		return 0;
+	else if (cs->name >= len || cs->texname >= len ||
+	  cs->array + (uint64_t) cs->array_size > len ||
+	  cs->indices + (uint64_t) cs->indices_num * isize > len)
+		return 0;
+	else if (cs->array % sizeof(float) != 0 || cs->indices % isize != 0)
+		return 0;
+
+	return check_indices(cs, buf);
+}
+
+static void drop_shapes(struct model *model, uint32_t num)
+{
+	while (num--) {
+		struct list_head *last = model->shapes.prev;
+		struct wfobj *shape = container_of(last, struct wfobj, head);
+
+		list_del(last);
+		free(shape->name);
+		free(shape->texname);
+		free(shape);
+	}
+}
+
+uint16_t cook_load(const char *path, uint64_t key, struct model *model,
+  struct cooked *cooked)
+{
+	struct stat st;
+	int fd;
+
+	cooked->buf = NULL;
+	cooked->len = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct cook_header)) {
+		close(fd);
+		return 0;
+	}
+
+	void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (buf == MAP_FAILED) {
+		ee("failed to map %s\n", path);
+		return 0;
+	}
+
+	cooked->buf = buf;
+	cooked->len = st.st_size;
+
+	const struct cook_header *hdr = buf;
+
+	if (hdr->magic != COOK_MAGIC || hdr->version != COOK_VERSION ||
+	  hdr->key != key || hdr->size != cooked->len ||
+	  hdr->shapes_num > UINT16_MAX || /* shape ids are 16-bit */
+	  sizeof(*hdr) + hdr->shapes_num * sizeof(struct cook_shape) >
+	  cooked->len) {
+		ww("stale cooked file %s\n", path);
+		cook_unmap(cooked);
+		return 0;
+	}
+
+	const struct cook_shape *shapes = (const void *) (hdr + 1);
+	uint32_t i;
+
+	for (i = 0; i < hdr->shapes_num; ++i) {
+		if (!check_shape(&shapes[i], cooked->buf, cooked->len)) {
+			ee("corrupted cooked file %s\n", path);
+			cook_unmap(cooked);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < hdr->shapes_num; ++i) {
+		const struct cook_shape *cs = &shapes[i];
+		struct wfobj *shape = calloc(1, sizeof(*shape));
+
+		if (!shape) {
+			ee("failed to allocate shape memory\n");
+			drop_shapes(model, i);
+			cook_unmap(cooked);
+			return 0;
+		}
+
+		shape->id = i;
+		shape->name = strndup((const char *) cooked->buf + cs->name,
+		  cooked->len - cs->name);
+
+		if (cs->texname)
+			shape->texname = strndup((const char *) cooked->buf +
+			  cs->texname, cooked->len - cs->texname);
+
+		shape->array = (void *) (cooked->buf + cs->array);
+		shape->array_size = cs->array_size;
+		shape->vertices_num = cs->vertices_num;
+		shape->indices = (void *) (cooked->buf + cs->indices);
+		shape->indices_num = cs->indices_num;
+		shape->indices_type = cs->indices_type;
+		shape->with_color = cs->with_color;
+		shape->visible = cs->visible;
+		shape->layout = cs->layout;
+		memcpy(shape->color.data, cs->color, sizeof(cs->color));
+
+		list_add(&model->shapes, &shape->head);
+	}
+
+	memcpy(model->min.data, hdr->min, sizeof(hdr->min));
+	memcpy(model->max.data, hdr->max, sizeof(hdr->max));
+
+	ii("loaded %u cooked shapes from %s\n", i, path);
+
+	return i;
+}
@@ -0,0 +1,249 @@
+/* decoder.c: image decoder registry
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <rgu/stb_image.h>
+
+#define TAG "decoder"
+
+#include <rgu/log.h>
+#include <rgu/time.h>
+#include <rgu/pool.h>
+#include <rgu/decoder.h>
+
+struct backend {
+	const char *name;
+	size_t (*bound)(const uint8_t *buf, uint32_t len); /* 0 if unknown */
+	uint8_t (*decode)(const uint8_t *buf, uint32_t len, struct image *img,
+	  uint8_t *dst, size_t size);
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct decoder_stats stats[IMAGE_TYPES];
+} registry = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const uint8_t png_sig[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+  '\n' };
+static const uint8_t jpeg_sig[] = { 0xff, 0xd8, 0xff };
+
+uint8_t image_type(const uint8_t *buf, uint32_t len)
+{
+	if (len >= sizeof(png_sig) && !memcmp(buf, png_sig, sizeof(png_sig)))
+		return IMAGE_PNG;
+	else if (len >= sizeof(jpeg_sig) &&
+	  !memcmp(buf, jpeg_sig, sizeof(jpeg_sig)))
+		return IMAGE_JPEG;
+	else
+		return IMAGE_OTHER;
+}
+
+static inline GLuint planes_format(uint8_t planes)
+{
+	static const GLuint formats[] = { 0, GL_LUMINANCE, GL_LUMINANCE_ALPHA,
+	  GL_RGB, GL_RGBA };
+
+	return planes <= 4 ? formats[planes] : 0;
+}
+
+static inline uint8_t format_planes(GLuint format)
+{
+	for (uint8_t planes = 1; planes <= 4; ++planes) {
+		if (planes_format(planes) == format)
+			return planes;
+	}
+
+	return 0;
+}
+
+static uint8_t stb_decode(const uint8_t *buf, uint32_t len,
+  struct image *img, uint8_t *dst, size_t size)
+{
+	int w;
+	int h;
+	int planes;
+	uint8_t *data;
+
+	(void) dst; /* stb_image always allocates */
+	(void) size;
+
+	if (!(data = stbi_load_from_memory(buf, len, &w, &h, &planes, 0))) {
+		ee("stb_image: %s\n", stbi_failure_reason());
+		return 0;
+	} else if (w > UINT16_MAX || h > UINT16_MAX) {
+		ee("image is too big %dx%d\n", w, h);
+		stbi_image_free(data);
+		return 0;
+	}
+
+	img->data = data;
+	img->size = (size_t) w * h * planes;
+	img->w = w;
+	img->h = h;
+	img->format = planes_format(planes);
+
+	return 1;
+}
+
+#ifdef HAVE_LIBPNG
+/* libpng output is rgb or rgba; width and height are in IHDR which must
+ * follow signature, alpha is not known before tRNS so assume it unless
+ * color type says rgb */
+
+static size_t png_bound(const uint8_t *buf, uint32_t len)
+{
+	const uint8_t *ihdr = buf + sizeof(png_sig) + 8;
+
+	if (len < sizeof(png_sig) + 8 + 13 || memcmp(ihdr - 4, "IHDR", 4))
+		return 0;
+
+	uint32_t w = (uint32_t) ihdr[0] << 24 | ihdr[1] << 16 | ihdr[2] << 8 |
+	  ihdr[3];
+	uint32_t h = (uint32_t) ihdr[4] << 24 | ihdr[5] << 16 | ihdr[6] << 8 |
+	  ihdr[7];
+
+	if (w > UINT16_MAX || h > UINT16_MAX)
+		return 0;
+
+	return (size_t) w * h * (ihdr[9] == 2 /* rgb */ ? 3 : 4);
+}
+
+static uint8_t png_backend(const uint8_t *buf, uint32_t len,
+  struct image *img, uint8_t *dst, size_t size)
+{
+	return png_decode(buf, len, img, dst, size);
+}
+#endif
+
+#ifdef HAVE_LIBJPEG
+/* decode in native format, grey stays one plane; cmyk and other rare
+ * layouts go to stb_image */
+
+static size_t jpeg_bound(const uint8_t *buf, uint32_t len)
+{
+	int w;
+	int h;
+	int planes;
+
+	if (!stbi_info_from_memory(buf, len, &w, &h, &planes) ||
+	  (planes != 1 && planes != 3) || w > UINT16_MAX || h > UINT16_MAX)
+		return 0;
+
+	return (size_t) w * h * planes;
+}
+
+static uint8_t jpeg_backend(const uint8_t *buf, uint32_t len,
+  struct image *img, uint8_t *dst, size_t size)
+{
+	struct jpg_opts opts = { .scale = 1 };
+	int w;
+	int h;
+	int planes;
+
+	if (!stbi_info_from_memory(buf, len, &w, &h, &planes) ||
+	  (planes != 1 && planes != 3))
+		return stb_decode(buf, len, img, dst, size);
+
+	opts.planes = planes;
+
+	return jpg_decode(buf, len, &opts, img, dst, size);
+}
+#endif
+
+static const struct backend backends[IMAGE_TYPES] = {
+#ifdef HAVE_LIBPNG
+	[IMAGE_PNG] = { "libpng", png_bound, png_backend },
+#else
+	[IMAGE_PNG] = { "stb_image", NULL, stb_decode },
+#endif
+#ifdef HAVE_LIBJPEG
+	[IMAGE_JPEG] = { "libjpeg", jpeg_bound, jpeg_backend },
+#else
+	[IMAGE_JPEG] = { "stb_image", NULL, stb_decode },
+#endif
+	[IMAGE_OTHER] = { "stb_image", NULL, stb_decode },
+};
+
+uint8_t image_decode(const struct asset_info *ainfo, struct image *img)
+{
+	uint8_t type = image_type(ainfo->buf, ainfo->len);
+	const struct backend *backend = &backends[type];
+	size_t capacity = 0;
+	uint8_t *dst = NULL;
+	uint64_t start = time_us();
+	uint8_t ret;
+
+	if (backend->bound) {
+		size_t need = backend->bound(ainfo->buf, ainfo->len);
+
+		if (need)
+			dst = pool_take(need, &capacity);
+	}
+
+	memset(img, 0, sizeof(*img));
+	ret = backend->decode(ainfo->buf, ainfo->len, img, dst, capacity);
+
+	uint64_t usecs = time_us() - start;
+
+	if (dst && (!ret || img->data != dst))
+		pool_give(dst, capacity);
+
+	if (ret && !format_planes(img->format)) {
+		ee("unsupported image layout\n");
+		image_release(img);
+		ret = 0;
+	}
+
+	pthread_mutex_lock(&registry.lock);
+	registry.stats[type].images++;
+	registry.stats[type].failures += !ret;
+	registry.stats[type].usecs += usecs;
+
+	if (ret) {
+		registry.stats[type].bytes += (size_t) img->w * img->h *
+		  format_planes(img->format);
+	}
+
+	pthread_mutex_unlock(&registry.lock);
+
+	if (ret) {
+		dd("%s %ux%u in %llu us\n", backend->name, img->w, img->h,
+		  (unsigned long long) usecs);
+	}
+
+	return ret;
+}
+
+void image_release(struct image *img)
+{
+	if (img->data && img->size)
+		pool_give(img->data, img->size);
+	else
+		free(img->data);
+
+	img->data = NULL;
+	img->size = 0;
+}
+
+void decoder_stats(uint8_t type, struct decoder_stats *stats)
+{
+	if (type >= IMAGE_TYPES) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	pthread_mutex_lock(&registry.lock);
+	*stats = registry.stats[type];
+	pthread_mutex_unlock(&registry.lock);
+}
@@ -0,0 +1,233 @@
+/* dither.c: 16-bit texel conversion
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define DITHER_SSE2
+#endif
+
+#define TAG "dither"
+
+#include <rgu/log.h>
+#include <rgu/mip.h>
+#include <rgu/dither.h>
+
+struct layout16 {
+	uint8_t bits[4];
+	uint8_t shift[4];
+};
+
+static const struct layout16 layouts[] = {
+	[MIP_RGB565] = { { 5, 6, 5, 0 }, { 11, 5, 0, 0 } },
+	[MIP_RGBA4444] = { { 4, 4, 4, 4 }, { 12, 8, 4, 0 } },
+	[MIP_RGBA5551] = { { 5, 5, 5, 1 }, { 11, 6, 1, 0 } },
+};
+
+static const uint8_t bayer[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 },
+};
+
+#define ROUND 127 /* threshold of plain rounding, see quantize() */
+
+/* level of v with n steps is (v * n + d) / 255, d in [0, 255) spreads
+ * quantization error: constant for rounding, bayer or noise for dither */
+
+static inline uint16_t quantize(uint8_t val, uint8_t bits, uint8_t d)
+{
+	return (val * ((1 << bits) - 1) + d) / 255;
+}
+
+static inline uint8_t threshold(uint8_t mode, uint16_t x, uint16_t y)
+{
+	return mode == DITHER_ORDERED ? bayer[y & 3][x & 3] * 16 + 8 : ROUND;
+}
+
+static inline uint16_t pack_texel(const uint8_t *px, const struct layout16 *l,
+  uint8_t d)
+{
+	uint16_t res = 0;
+
+	for (uint8_t c = 0; c < 4; ++c) {
+		if (l->bits[c])
+			res |= quantize(px[c], l->bits[c], l->bits[c] == 1 ?
+			  ROUND : d) << l->shift[c];
+	}
+
+	return res;
+}
+
+#ifdef DITHER_SSE2
+/* four texels per step; 16-bit lanes hold v * n + d which stays far below
+ * overflow for n < 64, division by 255 is exact for such values */
+
+static inline __m128i pack_pair(__m128i px, __m128i levels, __m128i d,
+  __m128i shifts)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i low = _mm_set_epi32(0, 0xffff, 0, 0xffff);
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(px, levels), d);
+
+	t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, one),
+	  _mm_srli_epi16(t, 8)), 8);
+	t = _mm_mullo_epi16(t, shifts); /* planes do not overlap, or them */
+	t = _mm_or_si128(t, _mm_srli_epi64(t, 32));
+	t = _mm_or_si128(t, _mm_srli_epi64(t, 16));
+	t = _mm_and_si128(t, low);
+
+	return _mm_shuffle_epi32(t, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+static uint16_t pack_row_sse2(const uint8_t *rgba, uint16_t w, uint16_t y,
+  const struct layout16 *l, uint8_t mode, uint16_t *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi32(0x8000);
+	const __m128i flip = _mm_set1_epi16((int16_t) 0x8000);
+	int16_t levels[8];
+	int16_t shifts[8];
+	int16_t d[2][8];
+	uint16_t x = 0;
+
+	for (uint8_t i = 0; i < 8; ++i) {
+		uint8_t c = i & 3;
+		uint8_t px = i >> 2;
+
+		levels[i] = (1 << l->bits[c]) - 1;
+		shifts[i] = l->bits[c] ? 1 << l->shift[c] : 0;
+
+		for (uint8_t half = 0; half < 2; ++half)
+			d[half][i] = l->bits[c] == 1 ? ROUND :
+			  threshold(mode, half * 2 + px, y);
+	}
+
+	__m128i vlevels = _mm_loadu_si128((const __m128i *) levels);
+	__m128i vshifts = _mm_loadu_si128((const __m128i *) shifts);
+	__m128i d0 = _mm_loadu_si128((const __m128i *) d[0]);
+	__m128i d1 = _mm_loadu_si128((const __m128i *) d[1]);
+
+	for (; x + 4 <= w; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *) (rgba + x * 4));
+		__m128i lo = pack_pair(_mm_unpacklo_epi8(px, zero), vlevels,
+		  d0, vshifts);
+		__m128i hi = pack_pair(_mm_unpackhi_epi8(px, zero), vlevels,
+		  d1, vshifts);
+		__m128i quad = _mm_sub_epi32(_mm_unpacklo_epi64(lo, hi), bias);
+
+		quad = _mm_xor_si128(_mm_packs_epi32(quad, quad), flip);
+		_mm_storel_epi64((__m128i *) (dst + x), quad);
+	}
+
+	return x;
+}
+#endif
+
+static void pack_row(const uint8_t *rgba, uint16_t w, uint16_t y,
+  const struct layout16 *l, uint8_t mode, uint16_t *dst)
+{
+	uint16_t x = 0;
+
+#ifdef DITHER_SSE2
+	x = pack_row_sse2(rgba, w, y, l, mode, dst);
+#endif
+	for (; x < w; ++x)
+		dst[x] = pack_texel(rgba + x * 4, l, threshold(mode, x, y));
+}
+
+/* error is kept in 1/16 units, row buffers have one texel of margin */
+
+static void diffuse_row(const uint8_t *rgba, uint16_t w,
+  const struct layout16 *l, int16_t *cur, int16_t *next, uint16_t *dst)
+{
+	memset(next, 0, (w + 2) * 4 * sizeof(*next));
+
+	for (uint16_t x = 0; x < w; ++x) {
+		const int16_t *err = cur + (x + 1) * 4;
+		uint16_t res = 0;
+
+		for (uint8_t c = 0; c < 4; ++c) {
+			uint8_t bits = l->bits[c];
+			uint16_t n = (1 << bits) - 1;
+			int16_t val = rgba[x * 4 + c] + err[c] / 16;
+
+			if (!bits)
+				continue;
+			else if (bits == 1) {
+				res |= (rgba[x * 4 + c] >= 128) << l->shift[c];
+				continue;
+			}
+
+			val = val < 0 ? 0 : (val > 255 ? 255 : val);
+
+			uint16_t q = quantize(val, bits, ROUND);
+			int16_t e = val - (q * 255 + n / 2) / n;
+
+			cur[(x + 2) * 4 + c] += e * 7;
+			next[x * 4 + c] += e * 3;
+			next[(x + 1) * 4 + c] += e * 5;
+			next[(x + 2) * 4 + c] += e;
+			res |= q << l->shift[c];
+		}
+
+		dst[x] = res;
+	}
+}
+
+uint8_t dither_pack16(const uint8_t *src, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t format, uint8_t mode, uint16_t *dst)
+{
+	const struct layout16 *l = &layouts[format];
+	uint8_t *row = NULL;
+	int16_t *err = NULL;
+
+	if (format != MIP_RGB565 && format != MIP_RGBA4444 &&
+	  format != MIP_RGBA5551) {
+		ee("unsupported 16-bit format %u\n", format);
+		return 0;
+	} else if ((planes == 3 && !(row = malloc((size_t) w * 4))) ||
+	  (mode == DITHER_DIFFUSE &&
+	  !(err = calloc((w + 2) * 4 * 2, sizeof(*err))))) {
+		ee("failed to allocate dither rows for width %u\n", w);
+		free(row);
+		return 0;
+	}
+
+	for (uint16_t y = 0; y < h; ++y) {
+		const uint8_t *line = src + (size_t) y * w * planes;
+
+		if (planes == 3) { /* widen so that kernels see whole texels */
+			for (uint16_t x = 0; x < w; ++x) {
+				memcpy(row + x * 4, line + x * 3, 3);
+				row[x * 4 + 3] = 0xff;
+			}
+
+			line = row;
+		}
+
+		if (mode == DITHER_DIFFUSE) {
+			int16_t *cur = err + (y & 1) * (w + 2) * 4;
+			int16_t *next = err + !(y & 1) * (w + 2) * 4;
+
+			diffuse_row(line, w, l, cur, next, dst);
+		} else {
+			pack_row(line, w, y, l, mode, dst);
+		}
+
+		dst += w;
+	}
+
+	free(row);
+	free(err);
+
+	return 1;
+}
@@ -0,0 +1,285 @@
+/* etc.c: etc1 texture compression
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <string.h>
+
+#include <rgu/etc.h>
+
+/* texels within block are numbered column by column as in etc1 spec, so
+ * for unflipped block left half is 0..7 and for flipped one top half is
+ * every texel with (i & 3) < 2 */
+
+static const int16_t modifiers[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+	{ 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+};
+
+struct fit {
+	uint32_t err;
+	uint8_t table;
+	uint8_t idx[16];
+};
+
+static inline uint8_t clamp8(int16_t val)
+{
+	return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
+
+static inline int16_t modifier(uint8_t table, uint8_t idx)
+{
+	int16_t val = modifiers[table][idx & 1];
+
+	return idx & 2 ? -val : val;
+}
+
+static inline uint8_t in_subblock(uint8_t i, uint8_t flip, uint8_t sub)
+{
+	return ((flip ? (i & 3) : (i >> 2)) >= 2) == sub;
+}
+
+static void gather_block(const uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes, uint16_t bx, uint16_t by, uint8_t texels[16][3])
+{
+	for (uint8_t x = 0; x < 4; ++x) {
+		uint16_t px = bx + x < w ? bx + x : w - 1;
+
+		for (uint8_t y = 0; y < 4; ++y) {
+			uint16_t py = by + y < h ? by + y : h - 1;
+			const uint8_t *src = pixels +
+			  ((size_t) py * w + px) * planes;
+
+			memcpy(texels[x * 4 + y], src, 3);
+		}
+	}
+}
+
+/* pick modifier table and per texel modifiers around given base color */
+
+static void fit_subblock(const uint8_t texels[16][3], uint8_t flip,
+  uint8_t sub, const int16_t base[3], struct fit *fit)
+{
+	fit->err = UINT32_MAX;
+
+	for (uint8_t t = 0; t < 8; ++t) {
+		int16_t colors[4][3];
+		uint8_t idx[16];
+		uint32_t err = 0;
+
+		for (uint8_t m = 0; m < 4; ++m) {
+			for (uint8_t c = 0; c < 3; ++c)
+				colors[m][c] = clamp8(base[c] + modifier(t, m));
+		}
+
+		for (uint8_t i = 0; i < 16 && err < fit->err; ++i) {
+			uint32_t best = UINT32_MAX;
+
+			if (!in_subblock(i, flip, sub))
+				continue;
+
+			for (uint8_t m = 0; m < 4; ++m) {
+				int16_t dr = colors[m][0] - texels[i][0];
+				int16_t dg = colors[m][1] - texels[i][1];
+				int16_t db = colors[m][2] - texels[i][2];
+				uint32_t cur = dr * dr + dg * dg + db * db;
+
+				if (cur < best) {
+					best = cur;
+					idx[i] = m;
+				}
+			}
+
+			err += best;
+		}
+
+		if (err < fit->err) {
+			fit->err = err;
+			fit->table = t;
+			memcpy(fit->idx, idx, sizeof(idx));
+		}
+	}
+}
+
+static void average(const uint8_t texels[16][3], uint8_t flip, uint8_t sub,
+  float avg[3])
+{
+	uint16_t sum[3] = { 0, 0, 0 };
+
+	for (uint8_t i = 0; i < 16; ++i) {
+		if (!in_subblock(i, flip, sub))
+			continue;
+
+		for (uint8_t c = 0; c < 3; ++c)
+			sum[c] += texels[i][c];
+	}
+
+	for (uint8_t c = 0; c < 3; ++c)
+		avg[c] = sum[c] / 8.f;
+}
+
+static inline uint8_t expand4(uint8_t val)
+{
+	return val << 4 | val;
+}
+
+static inline uint8_t expand5(uint8_t val)
+{
+	return val << 3 | val >> 2;
+}
+
+static void write_block(uint32_t hi, const struct fit *fit, uint8_t flip,
+  uint8_t *out)
+{
+	uint32_t lo = 0;
+
+	hi |= fit[0].table << 5 | fit[1].table << 2 | flip;
+
+	for (uint8_t i = 0; i < 16; ++i) {
+		uint8_t idx = fit[!in_subblock(i, flip, 0)].idx[i];
+
+		lo |= (uint32_t) (idx >> 1) << (16 + i) | (uint32_t) (idx & 1) << i;
+	}
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		out[i] = hi >> (24 - i * 8);
+		out[4 + i] = lo >> (24 - i * 8);
+	}
+}
+
+/* try both flips in individual and differential modes, keep best */
+
+static void encode_block(const uint8_t texels[16][3], uint8_t *out)
+{
+	uint32_t best = UINT32_MAX;
+
+	for (uint8_t flip = 0; flip < 2; ++flip) {
+		float avg[2][3];
+		uint8_t q4[2][3];
+		uint8_t q5[2][3];
+		int16_t base[3];
+		struct fit fit[2];
+		uint8_t diff = 1;
+
+		for (uint8_t s = 0; s < 2; ++s) {
+			average(texels, flip, s, avg[s]);
+
+			for (uint8_t c = 0; c < 3; ++c) {
+				q4[s][c] = avg[s][c] * 15 / 255 + .5f;
+				q5[s][c] = avg[s][c] * 31 / 255 + .5f;
+			}
+		}
+
+		for (uint8_t c = 0; c < 3; ++c) {
+			int8_t d = q5[1][c] - q5[0][c];
+
+			diff &= d >= -4 && d <= 3;
+		}
+
+		if (diff) {
+			for (uint8_t s = 0; s < 2; ++s) {
+				for (uint8_t c = 0; c < 3; ++c)
+					base[c] = expand5(q5[s][c]);
+
+				fit_subblock(texels, flip, s, base, &fit[s]);
+			}
+
+			if (fit[0].err + fit[1].err < best) {
+				uint32_t hi = 2;
+
+				best = fit[0].err + fit[1].err;
+
+				for (uint8_t c = 0; c < 3; ++c)
+					hi |= (uint32_t) q5[0][c] << (27 - c * 8) |
+					  (uint32_t) ((q5[1][c] - q5[0][c]) & 7) <<
+					  (24 - c * 8);
+
+				write_block(hi, fit, flip, out);
+			}
+		}
+
+		for (uint8_t s = 0; s < 2; ++s) {
+			for (uint8_t c = 0; c < 3; ++c)
+				base[c] = expand4(q4[s][c]);
+
+			fit_subblock(texels, flip, s, base, &fit[s]);
+		}
+
+		if (fit[0].err + fit[1].err < best) {
+			uint32_t hi = 0;
+
+			best = fit[0].err + fit[1].err;
+
+			for (uint8_t c = 0; c < 3; ++c)
+				hi |= (uint32_t) q4[0][c] << (28 - c * 8) |
+				  (uint32_t) q4[1][c] << (24 - c * 8);
+
+			write_block(hi, fit, flip, out);
+		}
+	}
+}
+
+void etc1_encode(const uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t *out)
+{
+	uint8_t texels[16][3];
+
+	for (uint32_t by = 0; by < h; by += 4) {
+		for (uint32_t bx = 0; bx < w; bx += 4) {
+			gather_block(pixels, w, h, planes, bx, by, texels);
+			encode_block(texels, out);
+			out += ETC1_BLOCK_BYTES;
+		}
+	}
+}
+
+static void decode_block(const uint8_t *in, uint8_t texels[16][3])
+{
+	uint32_t hi = (uint32_t) in[0] << 24 | in[1] << 16 | in[2] << 8 | in[3];
+	uint32_t lo = (uint32_t) in[4] << 24 | in[5] << 16 | in[6] << 8 | in[7];
+	uint8_t flip = hi & 1;
+	uint8_t table[2] = { hi >> 5 & 7, hi >> 2 & 7 };
+	uint8_t base[2][3];
+
+	for (uint8_t c = 0; c < 3; ++c) {
+		if (hi & 2) {
+			uint8_t q = hi >> (27 - c * 8) & 31;
+			int8_t d = (int8_t) ((hi >> (24 - c * 8) & 7) << 5) >> 5;
+
+			base[0][c] = expand5(q);
+			base[1][c] = expand5((q + d) & 31);
+		} else {
+			base[0][c] = expand4(hi >> (28 - c * 8) & 15);
+			base[1][c] = expand4(hi >> (24 - c * 8) & 15);
+		}
+	}
+
+	for (uint8_t i = 0; i < 16; ++i) {
+		uint8_t s = !in_subblock(i, flip, 0);
+		uint8_t idx = (lo >> (16 + i) & 1) << 1 | (lo >> i & 1);
+
+		for (uint8_t c = 0; c < 3; ++c)
+			texels[i][c] = clamp8(base[s][c] + modifier(table[s], idx));
+	}
+}
+
+void etc1_decode(const uint8_t *data, uint16_t w, uint16_t h, uint8_t *rgb)
+{
+	uint8_t texels[16][3];
+
+	for (uint32_t by = 0; by < h; by += 4) {
+		for (uint32_t bx = 0; bx < w; bx += 4) {
+			decode_block(data, texels);
+			data += ETC1_BLOCK_BYTES;
+
+			for (uint8_t x = 0; x < 4 && bx + x < w; ++x) {
+				for (uint8_t y = 0; y < 4 && by + y < h; ++y)
+					memcpy(rgb + ((by + y) * w + bx + x) * 3,
+					  texels[x * 4 + y], 3);
+			}
+		}
+	}
+}
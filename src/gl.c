@@ -7,6 +7,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #define TAG "gl"
 
@@ -99,3 +100,23 @@ GLuint gl_make_prog(const char *vsrc, const char *fsrc)
 
 	return prog;
 }
+
+uint8_t gl_extension(const char *name)
+{
+	const char *all = (const char *) glGetString(GL_EXTENSIONS);
+	const char *str = all;
+	size_t len = strlen(name);
+
+	if (!str)
+		return 0;
+
+	while ((str = strstr(str, name))) {
+		if ((str == all || str[-1] == ' ') &&
+		  (str[len] == ' ' || str[len] == '\0'))
+			return 1;
+
+		str += len;
+	}
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -109,237 +110,310 @@ err_png_create_write_struct:
 	ii("written ok %s\n", path);
 }
 
-#define PNG_FLAGS (PNG_TRANSFORM_STRIP_16 |\
-		   PNG_TRANSFORM_GRAY_TO_RGB |\
-		   PNG_TRANSFORM_PACKING |\
-		   PNG_TRANSFORM_EXPAND)
+/* png source, passed to read callbacks through png_get_io_ptr() so that
+ * any number of threads can decode at once */
 
-static int fd_;
+struct png_src {
+	int fd; /* file source if >= 0 */
+	const uint8_t *ptr;
+	const uint8_t *end; /* NULL if length is unknown */
+};
 
-static void pngio(png_structp png, png_bytep data, png_size_t size)
+static void pngread(png_structp png, png_bytep data, png_size_t size)
 {
-	read(fd_, data, size);
+	struct png_src *src = png_get_io_ptr(png);
+
+	if (src->fd >= 0) {
+		while (size) {
+			ssize_t len = read(src->fd, data, size);
+
+			if (len <= 0)
+				png_error(png, "short read");
+
+			data += len;
+			size -= len;
+		}
+	} else if (src->end && (size_t) (src->end - src->ptr) < size) {
+		png_error(png, "short buffer");
+	} else {
+		memcpy(data, src->ptr, size);
+		src->ptr += size;
+	}
 }
 
-uint8_t readpng(const char *path, struct image *img)
+static void pngerr(png_structp png, png_const_charp msg)
 {
-	uint8_t rc;
-	uint8_t n;
-	int16_t y;
-	size_t size;
-	uint8_t *dst;
-	png_structp png;
-	png_infop info;
-	png_bytep *rows;
+	ee("png: %s\n", msg);
+	png_longjmp(png, 1);
+}
 
-	if ((fd_ = open(path, O_RDONLY)) < 0) {
-		ee("open(%s) failed\n", path);
-		return 0;
-	}
+static void pngwarn(png_structp png, png_const_charp msg)
+{
+	ww("png: %s\n", msg);
+}
 
-	rc = 0;
-	info = NULL;
+/* decode rows straight into destination; dst is used if it holds size
+ * bytes, otherwise image memory is allocated here */
 
-	if (!(png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0))) {
+static uint8_t decode_png(struct png_src *src, struct image *img,
+  uint8_t *dst, size_t size)
+{
+	png_structp png;
+	png_infop info = NULL;
+	png_bytep *volatile rows = NULL;
+	uint8_t *volatile data = NULL;
+	volatile uint8_t rc = 0;
+
+	if (!(png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, pngerr,
+	  pngwarn))) {
 		ee("png_create_read_struct() failed\n");
-		goto out;
+		return 0;
 	}
 
-        if (!(info = png_create_info_struct(png))) {
+	if (!(info = png_create_info_struct(png))) {
 		ee("png_create_info_struct() failed\n");
 		goto out;
 	}
 
 	if (setjmp(png_jmpbuf(png))) {
-		ee("setjmp() failed\n");
-		goto out;
-	}
-
-        png_set_read_fn(png, (void *) &fd_, pngio);
-        png_read_png(png, info, PNG_FLAGS, 0);
+		if (data != dst)
+			free(data);
 
-	if (png_get_color_type(png, info) == PNG_COLOR_TYPE_RGBA) {
-		n = 4;
-		img->format = GL_RGBA;
-	} else if (png_get_color_type(png, info) == PNG_COLOR_TYPE_RGB) {
-		n = 3;
-		img->format = GL_RGB;
-	} else {
-		ee("unsupported color type, expect RGB\n");
 		goto out;
 	}
 
-	img->w = png_get_image_width(png, info);
-	img->h = png_get_image_height(png, info);
-	size = img->w * img->h * n;
+	png_set_read_fn(png, src, pngread);
+	png_read_info(png, info);
+
+	png_set_strip_16(png);
+	png_set_packing(png);
+	png_set_expand(png);
+	png_set_gray_to_rgb(png);
+	png_set_interlace_handling(png);
+	png_read_update_info(png, info);
 
-	ii("image %ux%u components %u bytes %zu\n", img->w, img->h, n, size);
+	uint32_t w = png_get_image_width(png, info);
+	uint32_t h = png_get_image_height(png, info);
+	uint8_t n = png_get_channels(png, info);
+	size_t stride = png_get_rowbytes(png, info);
 
-	if (!(img->data = calloc(1, size))) {
-		ee("failed to allocate %zu bytes\n", size);
+	if (w > UINT16_MAX || h > UINT16_MAX || (n != 3 && n != 4) ||
+	  stride != (size_t) w * n) {
+		ee("unsupported image %ux%u components %u\n", w, h, n);
 		goto out;
 	}
 
-        rows = png_get_rows(png, info);
-	dst = img->data;
+	if (dst && size >= stride * h) {
+		data = dst;
+	} else if (!(data = malloc(stride * h))) {
+		ee("failed to allocate %zu bytes\n", stride * h);
+		goto out;
+	}
 
-	for (y = 0; y < img->h; y++) {
-		const uint8_t *row = rows[y];
-		const uint8_t *end = row + img->w * n;
+	if (!(rows = png_malloc(png, h * sizeof(*rows))))
+		goto out;
 
-		while (row < end) {
-			*dst++ = *row++;
-			*dst++ = *row++;
-			*dst++ = *row++;
+	for (uint32_t y = 0; y < h; ++y)
+		rows[y] = data + y * stride;
 
-			if (n == 4)
-				*dst++ = *row++;
-		}
+	png_read_image(png, rows);
+	png_read_end(png, NULL);
 
-		dst = img->data + n * img->w * y;
-	}
+	dd("image %ux%u components %u bytes %zu\n", w, h, n, stride * h);
 
+	img->data = data;
+	img->size = data == dst ? size : stride * h;
+	img->w = w;
+	img->h = h;
+	img->format = n == 4 ? GL_RGBA : GL_RGB;
 	rc = 1;
 
 out:
-	if (png && info)
-		png_destroy_read_struct(&png, &info, 0);
+	if (rows)
+		png_free(png, rows);
 
-	close(fd_);
+	png_destroy_read_struct(&png, info ? &info : NULL, NULL);
 	return rc;
 }
 
-static void pngerr(png_structp png_ptr, png_const_charp msg)
+uint8_t readpng(const char *path, struct image *img)
 {
-	ee("png: %s\n", msg);
-}
+	struct png_src src = { .fd = open(path, O_RDONLY) };
 
-static const uint8_t *imgbuf_;
+	if (src.fd < 0) {
+		ee("open(%s) failed\n", path);
+		return 0;
+	}
 
-static void pngcpy(png_structp png, png_bytep data, png_size_t size)
-{
-	memcpy(data, imgbuf_, size);
-	imgbuf_ += size;
+	uint8_t rc = decode_png(&src, img, NULL, 0);
+
+	close(src.fd);
+	return rc;
 }
 
 #define PNG_SIGNATURE_LEN 8
 
-uint8_t buf2png(const uint8_t *buf, struct image *img)
+uint8_t png_decode(const uint8_t *buf, size_t len, struct image *img,
+  uint8_t *dst, size_t size)
 {
-	uint8_t n;
-	int16_t y;
-	size_t retsize;
-	uint8_t *ret;
-	uint8_t *dst;
-	png_structp png;
-	png_bytep *rows;
-	png_infop info = NULL;
+	struct png_src src = { .fd = -1, .ptr = buf, .end = len ? buf + len :
+	  NULL };
 
-	if (!png_check_sig(buf, PNG_SIGNATURE_LEN)) {
-		ee("bad PNG signature: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-				buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7]);
+	if ((len && len < PNG_SIGNATURE_LEN) ||
+	  png_sig_cmp(buf, 0, PNG_SIGNATURE_LEN)) {
+		ee("bad PNG signature\n");
 		return 0;
 	}
 
-	ret = NULL;
+	return decode_png(&src, img, dst, size);
+}
 
-	if (!(png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, pngerr, 0))) {
-		ee("png_create_read_struct() failed\n");
-		goto out;
-	}
+uint8_t buf2png(const uint8_t *buf, struct image *img)
+{
+	return png_decode(buf, 0, img, NULL, 0);
+}
 
-	if (!(info = png_create_info_struct(png))) {
-		ee("png_create_info_struct() failed\n");
-		goto out;
-	}
+struct my_error_mgr {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
 
-	imgbuf_ = buf + PNG_SIGNATURE_LEN;
+static void my_error_exit (j_common_ptr info)
+{
+	struct my_error_mgr *err = (struct my_error_mgr *) info->err;
 
-	if (setjmp(png_jmpbuf(png))) {
-		ee("error reading png file\n");
-		goto out;
+	(*info->err->output_message) (info);
+	longjmp(err->setjmp_buffer, 1);
+}
+
+static const struct jpg_opts jpg_defaults = { .planes = 1, .scale = 1 };
+
+/* widen rgb row stored in upper 3/4 of rgba row, front to back is safe
+ * since write position never passes read position */
+
+static inline void rgb_to_rgba(uint8_t *row, uint16_t w)
+{
+	const uint8_t *src = row + w;
+
+	for (uint16_t x = 0; x < w; ++x, src += 3, row += 4) {
+		row[0] = src[0];
+		row[1] = src[1];
+		row[2] = src[2];
+		row[3] = 0xff;
 	}
+}
 
-	png_set_sig_bytes(png, PNG_SIGNATURE_LEN);
-	png_set_read_fn(png, NULL, pngcpy);
-	png_read_png(png, info, PNG_FLAGS, 0);
+/* source manager is set by caller; rows are decoded straight into dst if
+ * it holds size bytes, otherwise image memory is allocated here */
 
-	if (png_get_color_type(png, info) == PNG_COLOR_TYPE_RGBA) {
-		n = 4;
-		img->format = GL_RGBA;
-	} else if (png_get_color_type(png, info) == PNG_COLOR_TYPE_RGB) {
-		n = 3;
-		img->format = GL_RGB;
+static uint8_t decode_jpg(struct jpeg_decompress_struct *inf,
+  struct my_error_mgr *jerr, const struct jpg_opts *opts, struct image *img,
+  uint8_t *dst, size_t size)
+{
+	uint8_t *volatile data = NULL;
+	uint8_t planes;
+	uint8_t widen = 0;
+
+	if (!opts)
+		opts = &jpg_defaults;
+
+	if (setjmp(jerr->setjmp_buffer)) {
+		if (data != dst)
+			free(data);
+
+		return 0;
+	}
+
+	jpeg_read_header(inf, TRUE);
+
+	if (opts->planes == 1) {
+		inf->out_color_space = JCS_GRAYSCALE;
+	} else if (opts->planes == 3) {
+		inf->out_color_space = JCS_RGB;
+	} else if (opts->planes == 4) {
+#ifdef JCS_ALPHA_EXTENSIONS
+		inf->out_color_space = JCS_EXT_RGBA;
+#else
+		inf->out_color_space = JCS_RGB;
+		widen = 1;
+#endif
 	} else {
-		ee("unsupported color type, expect RGB\n");
-		goto out;
+		ee("unsupported output components %u\n", opts->planes);
+		return 0;
 	}
 
-	uint16_t w = png_get_image_width(png, info);
-	uint16_t h = png_get_image_height(png, info);
+	if (opts->scale != 1 && opts->scale != 2 && opts->scale != 4 &&
+	  opts->scale != 8) {
+		ee("unsupported scale 1/%u\n", opts->scale);
+		return 0;
+	}
 
-	retsize = w * h * n;
+	/* dct domain downscale, skips idct work for dropped frequencies */
 
-	ii("image %ux%u components %u | need %zu bytes\n", w, h, n, retsize);
+	inf->scale_num = 1;
+	inf->scale_denom = opts->scale;
+	jpeg_start_decompress(inf);
 
-	if (!(ret = (uint8_t *) calloc(1, retsize)))
-		goto out;
+	uint32_t w = inf->output_width;
+	uint32_t h = inf->output_height;
+	size_t stride;
 
-	rows = png_get_rows(png, info);
+	planes = inf->output_components + widen;
+	stride = (size_t) w * planes;
 
-	dst = ret;
+	if (w > UINT16_MAX || h > UINT16_MAX || planes != opts->planes) {
+		ee("unsupported image %ux%u components %u\n", w, h, planes);
+		jpeg_abort_decompress(inf);
+		return 0;
+	}
 
-	for (y = 0; y < h; y++) {
-		const uint8_t *row = rows[y];
-		const uint8_t *end = row + w * n;
+	if (dst && size >= stride * h) {
+		data = dst;
+	} else if (!(data = malloc(stride * h))) {
+		ee("failed to allocate %zu bytes\n", stride * h);
+		jpeg_abort_decompress(inf);
+		return 0;
+	}
 
-		while (row < end) {
-			*dst++ = *row++;
-			*dst++ = *row++;
-			*dst++ = *row++;
+	JSAMPARRAY rows = (*inf->mem->alloc_small)((j_common_ptr) inf,
+	  JPOOL_IMAGE, h * sizeof(*rows));
 
-			if (n == 4)
-				*dst++ = *row++;
-		}
+	for (uint32_t y = 0; y < h; ++y)
+		rows[y] = data + y * stride + widen * w;
 
-		dst = ret + n * w * y;
-	}
+	/* library returns up to rec_outbuf_height rows per call */
 
-	img->data = ret;
-	img->w = w;
-	img->h = h;
+	while (inf->output_scanline < h) {
+		jpeg_read_scanlines(inf, rows + inf->output_scanline,
+		  h - inf->output_scanline);
+	}
 
-out:
-	if (png && info)
-		png_destroy_read_struct(&png, &info, 0);
+	if (widen) {
+		for (uint32_t y = 0; y < h; ++y)
+			rgb_to_rgba(data + y * stride, w);
+	}
 
-	return !!ret;
-}
+	jpeg_finish_decompress(inf);
 
-struct my_error_mgr {
-	struct jpeg_error_mgr pub;
-	jmp_buf setjmp_buffer;
-};
+	dd("image %ux%u components %u bytes %zu\n", w, h, planes, stride * h);
 
-static void my_error_exit (j_common_ptr info)
-{
-	struct my_error_mgr *err = (struct my_error_mgr *) info->err;
+	img->data = data;
+	img->size = data == dst ? size : stride * h;
+	img->w = w;
+	img->h = h;
+	img->format = planes == 1 ? GL_LUMINANCE : (planes == 3 ? GL_RGB :
+	  GL_RGBA);
 
-	(*info->err->output_message) (info);
-	longjmp(err->setjmp_buffer, 1);
+	return 1;
 }
 
-uint8_t readjpg(const char *path, struct image *img)
+uint8_t readjpg_opts(const char *path, const struct jpg_opts *opts,
+  struct image *img)
 {
-	uint8_t rc;
 	struct my_error_mgr jerr = {0};
 	struct jpeg_decompress_struct inf;
 	FILE *f;
-	JSAMPARRAY buf;
-	uint16_t stride;
-	size_t size;
-	uint8_t *out;
-	uint8_t *end;
+	uint8_t rc;
 
 	if (!(f = fopen(path, "rb"))) {
 		ee("fopen(%s) failed\n", path);
@@ -348,62 +422,37 @@ uint8_t readjpg(const char *path, struct image *img)
 
 	inf.err = jpeg_std_error(&jerr.pub);
 	jerr.pub.error_exit = my_error_exit;
-
-	if (setjmp(jerr.setjmp_buffer)) {
-		jpeg_destroy_decompress(&inf);
-		fclose(f);
-		return 0;
-	}
-
 	jpeg_create_decompress(&inf);
 	jpeg_stdio_src(&inf, f);
-	jpeg_read_header(&inf, TRUE);
-	jpeg_start_decompress(&inf);
-
-	stride = inf.output_width * inf.output_components;
-	size = inf.output_width * inf.output_height * inf.output_components;
-	rc = 0;
 
-	ii("image %ux%u components %u stride %u bytes %zu\n", inf.output_width,
-	   inf.output_height, inf.output_components, stride, size);
+	rc = decode_jpg(&inf, &jerr, opts, img, NULL, 0);
 
-	if (!(img->data = calloc(1, size))) {
-		ee("failed to allocate %zu bytes\n", size);
-		goto out;
-	}
-
-	out = img->data;
-	buf = (*inf.mem->alloc_sarray)((j_common_ptr) &inf, JPOOL_IMAGE, stride, 1);
-
-	while (inf.output_scanline < inf.output_height) {
-		jpeg_read_scanlines(&inf, buf, 1);
+	jpeg_destroy_decompress(&inf);
+	fclose(f);
 
-#if 1
-		/* convert to grayscale */
+	return rc;
+}
 
-		uint8_t *scanptr = buf[0];
-		uint8_t *scanend = scanptr + stride;
+uint8_t readjpg(const char *path, struct image *img)
+{
+	return readjpg_opts(path, NULL, img);
+}
 
-		while (scanptr < scanend) {
-			uint8_t gray = (*scanptr + *(scanptr + 1) + *(scanptr + 2)) / 3;
-			*scanptr = *(scanptr + 1) = *(scanptr + 2) = gray;
-			scanptr += 3;
-		}
-#endif
+uint8_t jpg_decode(const uint8_t *buf, size_t len, const struct jpg_opts *opts,
+  struct image *img, uint8_t *dst, size_t size)
+{
+	struct my_error_mgr jerr = {0};
+	struct jpeg_decompress_struct inf;
+	uint8_t rc;
 
-		memcpy(out, buf[0], stride);
-		out += stride;
-	}
+	inf.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+	jpeg_create_decompress(&inf);
+	jpeg_mem_src(&inf, buf, len);
 
-	img->format = GL_RGB;
-	img->w = inf.output_width;
-	img->h = inf.output_height;
-	rc = 1;
+	rc = decode_jpg(&inf, &jerr, opts, img, dst, size);
 
-out:
-	jpeg_finish_decompress(&inf);
 	jpeg_destroy_decompress(&inf);
-	fclose(f);
 
 	return rc;
 }
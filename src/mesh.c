@@ -0,0 +1,368 @@
+/* mesh.c: triangle mesh optimization helpers
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TAG "mesh"
+
+#include <rgu/log.h>
+#include <rgu/mesh.h>
+
+float mesh_acmr(const uint32_t *indices, uint32_t indices_num,
+  uint32_t vertices_num, uint8_t cache_size)
+{
+	uint32_t *stamps; /* fifo position when vertex was last loaded */
+	uint32_t misses = 0;
+
+	if (indices_num < 3)
+		return 0;
+	else if (!(stamps = calloc(vertices_num, sizeof(*stamps))))
+		return 0;
+
+	for (uint32_t i = 0; i < indices_num; ++i) {
+		uint32_t v = indices[i];
+
+		if (!stamps[v] || misses - stamps[v] >= cache_size)
+			stamps[v] = ++misses;
+	}
+
+	free(stamps);
+	return (float) misses / (indices_num / 3);
+}
+
+struct adjacency {
+	uint32_t *offsets; /* vertices_num + 1 */
+	uint32_t *triangles;
+};
+
+static uint8_t make_adjacency(const uint32_t *indices, uint32_t indices_num,
+  uint32_t vertices_num, struct adjacency *adj, uint32_t *live)
+{
+	adj->offsets = calloc(vertices_num + 1, sizeof(*adj->offsets));
+	adj->triangles = malloc(indices_num * sizeof(*adj->triangles));
+
+	if (!adj->offsets || !adj->triangles) {
+		ee("failed to allocate adjacency of %u vertices\n", vertices_num);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < indices_num; ++i)
+		live[indices[i]]++;
+
+	for (uint32_t v = 0; v < vertices_num; ++v)
+		adj->offsets[v + 1] = adj->offsets[v] + live[v];
+
+	uint32_t *fill = calloc(vertices_num, sizeof(*fill));
+
+	if (!fill) {
+		ee("failed to allocate adjacency of %u vertices\n", vertices_num);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < indices_num; ++i) {
+		uint32_t v = indices[i];
+
+		adj->triangles[adj->offsets[v] + fill[v]++] = i / 3;
+	}
+
+	free(fill);
+	return 1;
+}
+
+struct tipsify {
+	uint32_t *live; /* not yet emitted triangles per vertex */
+	uint32_t *stamps; /* cache time stamps */
+	uint32_t *dead_end;
+	uint32_t dead_end_num;
+	uint32_t cursor;
+	uint32_t time;
+	uint8_t cache_size;
+};
+
+static int64_t next_vertex(struct tipsify *ts, const uint32_t *candidates,
+  uint32_t candidates_num, uint32_t vertices_num)
+{
+	int64_t best = -1;
+	int64_t priority = -1;
+
+	for (uint32_t i = 0; i < candidates_num; ++i) {
+		uint32_t v = candidates[i];
+
+		if (!ts->live[v])
+			continue;
+
+		int64_t p = 0;
+
+		/* still in cache after fanning it */
+		if (ts->time - ts->stamps[v] + 2 * ts->live[v] <= ts->cache_size)
+			p = ts->time - ts->stamps[v];
+
+		if (p > priority) {
+			priority = p;
+			best = v;
+		}
+	}
+
+	if (best >= 0)
+		return best;
+
+	while (ts->dead_end_num) {
+		uint32_t v = ts->dead_end[--ts->dead_end_num];
+
+		if (ts->live[v])
+			return v;
+	}
+
+	for (; ts->cursor < vertices_num; ++ts->cursor) {
+		if (ts->live[ts->cursor])
+			return ts->cursor;
+	}
+
+	return -1;
+}
+
+struct cluster {
+	uint32_t first; /* triangle */
+	uint32_t num;
+	float sort;
+};
+
+static int cmp_clusters(const void *a, const void *b)
+{
+	const struct cluster *c0 = a;
+	const struct cluster *c1 = b;
+
+	return (c0->sort < c1->sort) - (c0->sort > c1->sort);
+}
+
+static void cluster_sort_key(const uint32_t *indices, const float *array,
+  uint32_t stride, const float center[3], struct cluster *cluster)
+{
+	float c[3] = { 0, 0, 0 };
+	float n[3] = { 0, 0, 0 };
+	float area = 0;
+
+	for (uint32_t t = cluster->first; t < cluster->first + cluster->num; ++t) {
+		const float *p0 = array + indices[t * 3] * stride;
+		const float *p1 = array + indices[t * 3 + 1] * stride;
+		const float *p2 = array + indices[t * 3 + 2] * stride;
+		float e0[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e1[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float fn[3] = {
+			e0[1] * e1[2] - e0[2] * e1[1],
+			e0[2] * e1[0] - e0[0] * e1[2],
+			e0[0] * e1[1] - e0[1] * e1[0],
+		};
+		float a = sqrtf(fn[0] * fn[0] + fn[1] * fn[1] + fn[2] * fn[2]);
+
+		/* face normal length is twice the area; weight centroid by it */
+		for (uint8_t k = 0; k < 3; ++k) {
+			n[k] += fn[k];
+			c[k] += (p0[k] + p1[k] + p2[k]) * a;
+		}
+
+		area += a;
+	}
+
+	if (area > 0) {
+		for (uint8_t k = 0; k < 3; ++k)
+			c[k] /= area * 3;
+	}
+
+	/* clusters facing away from mesh center occlude the rest */
+	cluster->sort = (c[0] - center[0]) * n[0] + (c[1] - center[1]) * n[1] +
+	  (c[2] - center[2]) * n[2];
+}
+
+static uint8_t sort_clusters(uint32_t *indices, uint32_t indices_num,
+  const float *array, uint32_t vertices_num, uint32_t stride,
+  struct cluster *clusters, uint32_t clusters_num)
+{
+	float center[3] = { 0, 0, 0 };
+
+	if (clusters_num < 2)
+		return 1;
+
+	for (uint32_t v = 0; v < vertices_num; ++v) {
+		for (uint8_t k = 0; k < 3; ++k)
+			center[k] += array[v * stride + k];
+	}
+
+	for (uint8_t k = 0; k < 3; ++k)
+		center[k] /= vertices_num;
+
+	for (uint32_t i = 0; i < clusters_num; ++i)
+		cluster_sort_key(indices, array, stride, center, &clusters[i]);
+
+	qsort(clusters, clusters_num, sizeof(*clusters), cmp_clusters);
+
+	uint32_t *tmp = malloc(indices_num * sizeof(*tmp));
+	uint32_t pos = 0;
+
+	if (!tmp) {
+		ee("failed to allocate %u indices\n", indices_num);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < clusters_num; ++i) {
+		memcpy(tmp + pos, indices + clusters[i].first * 3,
+		  clusters[i].num * 3 * sizeof(*tmp));
+		pos += clusters[i].num * 3;
+	}
+
+	memcpy(indices, tmp, indices_num * sizeof(*tmp));
+	free(tmp);
+	return 1;
+}
+
+uint8_t mesh_optimize_triangles(uint32_t *indices, uint32_t indices_num,
+  const float *array, uint32_t vertices_num, uint32_t stride,
+  uint8_t cache_size)
+{
+	uint32_t triangles_num = indices_num / 3;
+	struct adjacency adj = { NULL, NULL };
+	struct tipsify ts = {0};
+	uint8_t *emitted = calloc(triangles_num, sizeof(*emitted));
+	uint32_t *out = malloc(indices_num * sizeof(*out));
+	uint32_t *candidates = malloc(indices_num * sizeof(*candidates));
+	struct cluster *clusters = malloc(triangles_num * sizeof(*clusters));
+	uint32_t clusters_num = 0;
+	uint32_t out_num = 0;
+	uint8_t ret = 0;
+
+	ts.live = calloc(vertices_num, sizeof(*ts.live));
+	ts.stamps = calloc(vertices_num, sizeof(*ts.stamps));
+	ts.dead_end = malloc(indices_num * sizeof(*ts.dead_end));
+	ts.cache_size = cache_size;
+	ts.time = cache_size + 1;
+
+	if (!emitted || !out || !candidates || !clusters || !ts.live ||
+	  !ts.stamps || !ts.dead_end) {
+		ee("failed to allocate tipsify data for %u triangles\n",
+		  triangles_num);
+		goto out;
+	}
+
+	if (!triangles_num ||
+	  !make_adjacency(indices, indices_num, vertices_num, &adj, ts.live))
+		goto out;
+
+	int64_t f = next_vertex(&ts, NULL, 0, vertices_num);
+	uint8_t fresh = 1;
+
+	while (f >= 0) {
+		uint32_t candidates_num = 0;
+
+		if (fresh) {
+			if (clusters_num)
+				clusters[clusters_num - 1].num = out_num / 3 -
+				  clusters[clusters_num - 1].first;
+
+			clusters[clusters_num].first = out_num / 3;
+			clusters_num++;
+		}
+
+		for (uint32_t i = adj.offsets[f]; i < adj.offsets[f + 1]; ++i) {
+			uint32_t t = adj.triangles[i];
+
+			if (emitted[t])
+				continue;
+
+			for (uint8_t k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+
+				out[out_num++] = v;
+				ts.dead_end[ts.dead_end_num++] = v;
+				candidates[candidates_num++] = v;
+				ts.live[v]--;
+
+				if (ts.time - ts.stamps[v] > cache_size)
+					ts.stamps[v] = ts.time++;
+			}
+
+			emitted[t] = 1;
+		}
+
+		f = next_vertex(&ts, candidates, candidates_num, vertices_num);
+
+		/* cache is effectively flushed when fanning continues from
+		 * vertex that is not in cache; safe place to cut cluster */
+		fresh = f >= 0 && ts.time - ts.stamps[f] > cache_size;
+	}
+
+	clusters[clusters_num - 1].num = out_num / 3 -
+	  clusters[clusters_num - 1].first;
+
+	if (out_num != indices_num) {
+		ee("tipsify emitted %u of %u indices\n", out_num, indices_num);
+		goto out;
+	}
+
+	memcpy(indices, out, indices_num * sizeof(*indices));
+	ret = sort_clusters(indices, indices_num, array, vertices_num, stride,
+	  clusters, clusters_num);
+
+	dd("%u triangles in %u clusters\n", triangles_num, clusters_num);
+out:
+	free(adj.offsets);
+	free(adj.triangles);
+	free(emitted);
+	free(out);
+	free(candidates);
+	free(clusters);
+	free(ts.live);
+	free(ts.stamps);
+	free(ts.dead_end);
+	return ret;
+}
+
+uint8_t mesh_optimize_vertices(uint32_t *indices, uint32_t indices_num,
+  float *array, uint32_t vertices_num, uint32_t stride)
+{
+	uint32_t *remap = malloc(vertices_num * sizeof(*remap));
+	float *tmp = malloc(vertices_num * stride * sizeof(*tmp));
+	uint32_t next = 0;
+
+	if (!remap || !tmp) {
+		ee("failed to allocate %u vertices\n", vertices_num);
+		free(remap);
+		free(tmp);
+		return 0;
+	}
+
+	memset(remap, 0xff, vertices_num * sizeof(*remap));
+
+	for (uint32_t i = 0; i < indices_num; ++i) {
+		uint32_t v = indices[i];
+
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = next;
+			memcpy(tmp + next * stride, array + v * stride,
+			  stride * sizeof(*tmp));
+			next++;
+		}
+
+		indices[i] = remap[v];
+	}
+
+	/* welded vertices are all referenced; keep unused ones anyway */
+	for (uint32_t v = 0; v < vertices_num; ++v) {
+		if (remap[v] == UINT32_MAX) {
+			memcpy(tmp + next * stride, array + v * stride,
+			  stride * sizeof(*tmp));
+			next++;
+		}
+	}
+
+	memcpy(array, tmp, vertices_num * stride * sizeof(*tmp));
+	free(remap);
+	free(tmp);
+	return 1;
+}
@@ -0,0 +1,237 @@
+/* mip.c: mip chain builder
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#define MIP_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIP_NEON
+#endif
+
+#define TAG "mip"
+
+#include <rgu/log.h>
+#include <rgu/mip.h>
+
+#define LINEAR_STEPS 4096 /* linear to srgb table resolution */
+
+static float srgb_linear[256];
+static uint8_t linear_srgb[LINEAR_STEPS];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
+{
+	for (uint16_t i = 0; i < 256; ++i) {
+		float c = i / 255.f;
+
+		srgb_linear[i] = c <= .04045f ? c / 12.92f :
+		  powf((c + .055f) / 1.055f, 2.4f);
+	}
+
+	for (uint16_t i = 0; i < LINEAR_STEPS; ++i) {
+		float c = i / (float) (LINEAR_STEPS - 1);
+
+		c = c <= .0031308f ? c * 12.92f :
+		  1.055f * powf(c, 1 / 2.4f) - .055f;
+		linear_srgb[i] = c * 255 + .5f;
+	}
+}
+
+/* widen row to linear rgba floats so that filter works on whole texels */
+
+static void expand_row(const uint8_t *src, uint16_t w, uint8_t planes,
+  float *dst)
+{
+	for (uint16_t x = 0; x < w; ++x, src += planes, dst += 4) {
+		dst[0] = srgb_linear[src[0]];
+		dst[1] = srgb_linear[src[1]];
+		dst[2] = srgb_linear[src[2]];
+		dst[3] = planes == 4 ? src[3] / 255.f : 1;
+	}
+}
+
+static void pack_row(const float *src, uint16_t w, uint8_t planes,
+  uint8_t *dst)
+{
+	for (uint16_t x = 0; x < w; ++x, src += 4, dst += planes) {
+		for (uint8_t c = 0; c < 3; ++c)
+			dst[c] = linear_srgb[(uint16_t) (src[c] *
+			  (LINEAR_STEPS - 1) + .5f)];
+
+		if (planes == 4)
+			dst[3] = src[3] * 255 + .5f;
+	}
+}
+
+/* average rows into first one; on odd height last row is folded in */
+
+static void blend_rows(float *r0, const float *r1, const float *r2,
+  uint16_t w)
+{
+	uint32_t n = (uint32_t) w * 4;
+	float k = r2 ? 1 / 3.f : .5f;
+
+	for (uint32_t i = 0; i < n; i += 4) {
+#if defined(MIP_SSE)
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(r0 + i),
+		  _mm_loadu_ps(r1 + i));
+
+		if (r2)
+			sum = _mm_add_ps(sum, _mm_loadu_ps(r2 + i));
+
+		_mm_storeu_ps(r0 + i, _mm_mul_ps(sum, _mm_set1_ps(k)));
+#elif defined(MIP_NEON)
+		float32x4_t sum = vaddq_f32(vld1q_f32(r0 + i),
+		  vld1q_f32(r1 + i));
+
+		if (r2)
+			sum = vaddq_f32(sum, vld1q_f32(r2 + i));
+
+		vst1q_f32(r0 + i, vmulq_n_f32(sum, k));
+#else
+		for (uint8_t c = 0; c < 4; ++c)
+			r0[i + c] = (r0[i + c] + r1[i + c] +
+			  (r2 ? r2[i + c] : 0)) * k;
+#endif
+	}
+}
+
+/* average texel pairs; on odd width last texel is folded into last pair */
+
+static void reduce_row(const float *src, uint16_t sw, float *dst,
+  uint16_t dw)
+{
+	for (uint16_t x = 0; x < dw; ++x, dst += 4) {
+		const float *t0 = src + (size_t) x * 2 * 4;
+		const float *t1 = sw > 1 ? t0 + 4 : t0;
+		const float *t2 = (sw & 1) && sw > 1 && x == dw - 1 ?
+		  t1 + 4 : NULL;
+		float k = t2 ? 1 / 3.f : .5f;
+#if defined(MIP_SSE)
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(t0), _mm_loadu_ps(t1));
+
+		if (t2)
+			sum = _mm_add_ps(sum, _mm_loadu_ps(t2));
+
+		_mm_storeu_ps(dst, _mm_mul_ps(sum, _mm_set1_ps(k)));
+#elif defined(MIP_NEON)
+		float32x4_t sum = vaddq_f32(vld1q_f32(t0), vld1q_f32(t1));
+
+		if (t2)
+			sum = vaddq_f32(sum, vld1q_f32(t2));
+
+		vst1q_f32(dst, vmulq_n_f32(sum, k));
+#else
+		for (uint8_t c = 0; c < 4; ++c)
+			dst[c] = (t0[c] + t1[c] + (t2 ? t2[c] : 0)) * k;
+#endif
+	}
+}
+
+static void reduce_level(const uint8_t *src, uint16_t sw, uint16_t sh,
+  uint8_t *dst, uint16_t dw, uint16_t dh, uint8_t planes, float *rows)
+{
+	float *r0 = rows;
+	float *r1 = rows + (size_t) sw * 4;
+	float *r2 = rows + (size_t) sw * 8;
+	float *out = rows + (size_t) sw * 12;
+
+	for (uint16_t y = 0; y < dh; ++y) {
+		uint32_t y0 = (uint32_t) y * 2;
+		uint32_t y1 = y0 + 1 < sh ? y0 + 1 : sh - 1u;
+		uint8_t odd = (sh & 1) && sh > 1 && y == dh - 1;
+
+		expand_row(src + (size_t) y0 * sw * planes, sw, planes, r0);
+		expand_row(src + (size_t) y1 * sw * planes, sw, planes, r1);
+
+		if (odd)
+			expand_row(src + (size_t) (y1 + 1) * sw * planes, sw,
+			  planes, r2);
+
+		blend_rows(r0, r1, odd ? r2 : NULL, sw);
+		reduce_row(r0, sw, out, dw);
+		pack_row(out, dw, planes, dst + (size_t) y * dw * planes);
+	}
+}
+
+uint8_t mip_build(const uint8_t *pixels, uint16_t w, uint16_t h,
+  uint8_t planes, uint8_t levels, struct mip_chain *chain)
+{
+	uint32_t size = 0;
+	uint16_t lw = w;
+	uint16_t lh = h;
+
+	memset(chain, 0, sizeof(*chain));
+
+	if (!w || !h || (planes != 3 && planes != 4)) {
+		ee("unsupported image %ux%u planes %u\n", w, h, planes);
+		return 0;
+	}
+
+	levels = levels && levels < MIP_MAX_LEVELS ? levels : MIP_MAX_LEVELS;
+
+	while (chain->levels < levels) {
+		struct mip_level *level = &chain->level[chain->levels++];
+
+		level->w = lw;
+		level->h = lh;
+		level->offset = size;
+		level->size = (uint32_t) lw * lh * planes;
+		size += level->size;
+
+		if (lw == 1 && lh == 1)
+			break;
+
+		lw = lw > 1 ? lw / 2 : 1;
+		lh = lh > 1 ? lh / 2 : 1;
+	}
+
+	float *rows = malloc((size_t) w * 4 * 4 * sizeof(*rows));
+
+	if (!(chain->data = malloc(size)) || !rows) {
+		ee("failed to allocate %u bytes for %u mip levels\n", size,
+		  chain->levels);
+		free(rows);
+		mip_free(chain);
+		return 0;
+	}
+
+	pthread_once(&tables_once, init_tables);
+
+	chain->size = size;
+	chain->planes = planes;
+	memcpy(chain->data, pixels, chain->level[0].size);
+
+	for (uint8_t i = 1; i < chain->levels; ++i) {
+		const struct mip_level *src = &chain->level[i - 1];
+		const struct mip_level *dst = &chain->level[i];
+
+		reduce_level(chain->data + src->offset, src->w, src->h,
+		  chain->data + dst->offset, dst->w, dst->h, planes, rows);
+	}
+
+	free(rows);
+
+	dd("built %u levels of %ux%u | %u bytes\n", chain->levels, w, h, size);
+
+	return 1;
+}
+
+void mip_free(struct mip_chain *chain)
+{
+	free(chain->data);
+	chain->data = NULL;
+	chain->size = 0;
+	chain->levels = 0;
+}
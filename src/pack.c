@@ -0,0 +1,200 @@
+/* pack.c: packed asset archive
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define TAG "pack"
+
+#include <rgu/log.h>
+#include <rgu/pack.h>
+
+struct pack {
+	const uint8_t *buf;
+	size_t len;
+	const struct pack_entry *entries;
+	uint32_t entries_num;
+};
+
+static struct {
+	struct pack packs[PACK_MAX];
+	uint8_t packs_num;
+} mounted;
+
+static uint64_t hash_name(const char *name)
+{
+	uint64_t h = 14695981039346656037ull; /* fnv-1a */
+
+	for (const char *ptr = name; *ptr; ++ptr)
+		h = (h ^ (uint8_t) *ptr) * 1099511628211ull;
+
+	return h;
+}
+
+uint64_t pack_hash(const char *path)
+{
+	char buf[PATH_MAX];
+
+	normalize_path(path, buf, sizeof(buf));
+
+	return hash_name(buf);
+}
+
+static uint8_t check_pack(const char *path, const struct pack *pack)
+{
+	const struct pack_header *hdr = (const struct pack_header *) pack->buf;
+
+	if (pack->len < sizeof(*hdr) || hdr->magic != PACK_MAGIC ||
+	  hdr->version != PACK_VERSION) {
+		ee("%s is not rgu pack or has other version\n", path);
+		return 0;
+	} else if (hdr->entries > (pack->len - sizeof(*hdr)) /
+	  sizeof(struct pack_entry)) {
+		ee("%s index is truncated\n", path);
+		return 0;
+	}
+
+	const struct pack_entry *entries = (const struct pack_entry *) (hdr + 1);
+
+	for (uint32_t i = 0; i < hdr->entries; ++i) {
+		if (entries[i].offset > pack->len ||
+		  entries[i].len > pack->len - entries[i].offset) {
+			ee("%s entry %u is out of file\n", path, i);
+			return 0;
+		} else if (i && entries[i].hash < entries[i - 1].hash) {
+			ee("%s index is not sorted\n", path);
+			return 0;
+		} else if (entries[i].name >= pack->len ||
+		  !memchr(pack->buf + entries[i].name, '\0',
+		  pack->len - entries[i].name)) {
+			ee("%s entry %u has no name\n", path, i);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+uint8_t pack_mount(const char *path)
+{
+	struct pack pack;
+	struct stat st;
+	void *buf;
+	int fd;
+
+	if (mounted.packs_num == PACK_MAX) {
+		ee("failed to mount %s, %u packs are mounted\n", path,
+		  PACK_MAX);
+		return 0;
+	} else if ((fd = open(path, O_RDONLY)) < 0) {
+		ee("failed to open pack %s\n", path);
+		return 0;
+	} else if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		ee("failed to get size of pack %s\n", path);
+		close(fd);
+		return 0;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); /* mapping keeps file */
+
+	if (buf == MAP_FAILED) {
+		ee("failed to map pack %s\n", path);
+		return 0;
+	}
+
+	pack.buf = buf;
+	pack.len = st.st_size;
+
+	if (!check_pack(path, &pack)) {
+		munmap(buf, pack.len);
+		return 0;
+	}
+
+	pack.entries_num = ((const struct pack_header *) buf)->entries;
+	pack.entries = (const struct pack_entry *) ((const uint8_t *) buf +
+	  sizeof(struct pack_header));
+
+	mounted.packs[mounted.packs_num++] = pack;
+	ii("mounted %s with %u entries\n", path, pack.entries_num);
+
+	return 1;
+}
+
+void pack_unmount(void)
+{
+	for (uint8_t i = 0; i < mounted.packs_num; ++i) {
+		struct pack *pack = &mounted.packs[i];
+
+		munmap((void *) pack->buf, pack->len);
+	}
+
+	mounted.packs_num = 0;
+}
+
+/* paths of same hash are stored side by side, names tell them apart */
+
+static const struct pack_entry *find_entry(const struct pack *pack,
+  uint64_t hash, const char *name)
+{
+	uint32_t lo = 0;
+	uint32_t hi = pack->entries_num;
+
+	while (lo < hi) { /* first entry with hash */
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (pack->entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < pack->entries_num && pack->entries[lo].hash == hash; ++lo) {
+		const struct pack_entry *entry = &pack->entries[lo];
+
+		if (strcmp((const char *) pack->buf + entry->name, name) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+uint8_t pack_find(const char *path, struct asset_info *ainfo)
+{
+	if (!mounted.packs_num)
+		return 0;
+
+	char name[PATH_MAX];
+
+	normalize_path(path, name, sizeof(name));
+
+	uint64_t hash = hash_name(name);
+
+	for (uint8_t i = mounted.packs_num; i-- > 0; ) {
+		const struct pack *pack = &mounted.packs[i];
+		const struct pack_entry *entry = find_entry(pack, hash, name);
+
+		if (!entry)
+			continue;
+
+		ainfo->buf = pack->buf + entry->offset;
+		ainfo->len = entry->len;
+		ainfo->asset = pack;
+		ainfo->fd = -1;
+		ainfo->source = ASSET_PACK;
+
+		return 1;
+	}
+
+	return 0;
+}
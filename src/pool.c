@@ -0,0 +1,107 @@
+/* pool.c: reusable buffers for decoded assets
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <rgu/pool.h>
+
+struct slot {
+	uint8_t *data;
+	size_t size;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct slot slots[POOL_SLOTS];
+	size_t idle; /* bytes held by slots */
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+uint8_t *pool_take(size_t size, size_t *capacity)
+{
+	struct slot *best = NULL;
+	uint8_t *data = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+
+	for (uint8_t i = 0; i < POOL_SLOTS; ++i) {
+		struct slot *slot = &pool.slots[i];
+
+		if (slot->data && slot->size >= size &&
+		  (!best || slot->size < best->size))
+			best = slot;
+	}
+
+	if (best) {
+		data = best->data;
+		*capacity = best->size;
+		pool.idle -= best->size;
+		best->data = NULL;
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	if (!data && (data = malloc(size ? size : 1)))
+		*capacity = size;
+
+	return data;
+}
+
+/* keep bigger buffers, they are costlier to fault in again */
+
+void pool_give(uint8_t *data, size_t size)
+{
+	struct slot *slot = NULL;
+
+	if (!data)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+
+	for (uint8_t i = 0; i < POOL_SLOTS; ++i) {
+		struct slot *cur = &pool.slots[i];
+
+		if (!cur->data) {
+			slot = cur;
+			break;
+		} else if (cur->size < size && (!slot ||
+		  cur->size < slot->size)) {
+			slot = cur;
+		}
+	}
+
+	if (slot && pool.idle - (slot->data ? slot->size : 0) + size <=
+	  POOL_BYTES) {
+		uint8_t *old = slot->data;
+
+		pool.idle += size - (old ? slot->size : 0);
+		slot->data = data;
+		slot->size = size;
+		data = old;
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+	free(data);
+}
+
+void pool_trim(void)
+{
+	struct slot slots[POOL_SLOTS];
+
+	pthread_mutex_lock(&pool.lock);
+	memcpy(slots, pool.slots, sizeof(slots));
+	memset(pool.slots, 0, sizeof(pool.slots));
+	pool.idle = 0;
+	pthread_mutex_unlock(&pool.lock);
+
+	for (uint8_t i = 0; i < POOL_SLOTS; ++i)
+		free(slots[i].data);
+}
@@ -0,0 +1,468 @@
+/* prefetch.c: asynchronous asset prefetch
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__linux__) && !defined(NO_URING)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#define PREFETCH_URING
+#endif
+#endif
+
+#define TAG "prefetch"
+
+#include <rgu/log.h>
+#include <rgu/list.h>
+#include <rgu/asset.h>
+#include <rgu/prefetch.h>
+
+#define READ_CHUNK (128 << 10)
+#define QUEUE_DEPTH 32
+
+struct batch {
+	struct list_head head;
+	const void *amgr;
+	void (*done)(const char *path, uint8_t ok, void *data);
+	void *data;
+	uint16_t paths_num;
+	char *paths[];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	uint8_t started;
+	uint8_t stop;
+	struct list_head pending; /* batches, protected by lock */
+} engine = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.pending = { &engine.pending, &engine.pending },
+};
+
+struct file {
+	int fd;
+	uint64_t size;
+	uint64_t offset; /* next chunk to read */
+};
+
+#ifdef PREFETCH_URING
+/* bare minimum of io_uring, without liburing */
+
+struct uring {
+	int fd;
+	unsigned entries;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *ring;
+	size_t ring_len;
+	size_t sqes_len;
+	uint8_t failed; /* some read did not make it */
+};
+
+static void uring_exit(struct uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+
+	if (ring->ring)
+		munmap(ring->ring, ring->ring_len);
+
+	close(ring->fd);
+}
+
+/* 5.1 to 5.5 kernels have io_uring but no plain reads, nor probing */
+
+static uint8_t uring_probe(int fd)
+{
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) +
+	  (IORING_OP_READ + 1) * sizeof(struct io_uring_probe_op));
+	uint8_t ret = 0;
+
+	if (probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+	  probe, IORING_OP_READ + 1) == 0 && IORING_OP_READ < probe->ops_len)
+		ret = !!(probe->ops[IORING_OP_READ].flags &
+		  IO_URING_OP_SUPPORTED);
+
+	free(probe);
+	return ret;
+}
+
+static uint8_t uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params p = {0};
+
+	memset(ring, 0, sizeof(*ring));
+
+	if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+		return 0;
+	} else if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	  !uring_probe(ring->fd)) {
+		close(ring->fd);
+		return 0;
+	}
+
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries *
+	  sizeof(struct io_uring_cqe);
+
+	ring->ring_len = sq_len > cq_len ? sq_len : cq_len;
+	ring->ring = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+	  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+	  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		ring->ring = ring->ring == MAP_FAILED ? NULL : ring->ring;
+		ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+		uring_exit(ring);
+		return 0;
+	}
+
+	uint8_t *ptr = ring->ring;
+
+	ring->entries = p.sq_entries;
+	ring->sq_tail = (unsigned *) (ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) (ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *) (ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *) (ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) (ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (ptr + p.cq_off.cqes);
+
+	return 1;
+}
+
+static void uring_read(struct uring *ring, int fd, void *buf, uint32_t len,
+  uint64_t offset, uint64_t user_data)
+{
+	unsigned tail = *ring->sq_tail; /* only this thread submits */
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	ring->sq_array[idx] = idx;
+
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* submit queued reads and reap completions, wait for at least one if
+ * wait is set; returns number of reaped reads */
+
+static unsigned uring_run(struct uring *ring, unsigned submit, uint8_t wait)
+{
+	unsigned head = *ring->cq_head;
+	unsigned reaped = 0;
+
+	if ((submit || wait) && syscall(__NR_io_uring_enter, ring->fd, submit,
+	  wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+		ee("io_uring_enter() failed\n");
+		ring->failed = 1;
+		return 0;
+	}
+
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; ++head, ++reaped) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+		if (cqe->res < 0) {
+			dd("read of file %llu failed: %d\n",
+			  (unsigned long long) cqe->user_data, cqe->res);
+			ring->failed = 1;
+		}
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return reaped;
+}
+
+/* keep QUEUE_DEPTH chunk reads in flight over all files; data lands in
+ * page cache, scratch copy is thrown away; 0 if io_uring is not usable or
+ * some read failed, then caller falls back to fadvise */
+
+static uint8_t read_files(struct file *files, uint16_t num)
+{
+	static uint8_t scratch[READ_CHUNK];
+	struct uring ring;
+	unsigned inflight = 0;
+	uint16_t cur = 0;
+
+	if (!uring_init(&ring, QUEUE_DEPTH))
+		return 0;
+
+	for (;;) {
+		unsigned queued = 0;
+
+		while (inflight + queued < ring.entries && cur < num) {
+			struct file *file = &files[cur];
+
+			if (file->fd < 0 || file->offset >= file->size) {
+				cur++;
+				continue;
+			}
+
+			uring_read(&ring, file->fd, scratch, READ_CHUNK,
+			  file->offset, cur);
+			file->offset += READ_CHUNK;
+			queued++;
+		}
+
+		inflight += queued;
+
+		if (!inflight)
+			break;
+
+		unsigned reaped = uring_run(&ring, queued, 1);
+
+		if (ring.failed)
+			break;
+
+		inflight -= reaped;
+	}
+
+	uring_exit(&ring); /* cancels reads still in flight */
+	return !ring.failed;
+}
+#else
+static uint8_t read_files(struct file *files, uint16_t num)
+{
+	(void) files;
+	(void) num;
+	return 0;
+}
+#endif
+
+/* start reading all files at once so that disk sees whole batch instead
+ * of page faults one by one; paths which are not plain files, e.g. ones
+ * in packs or android assets, are skipped */
+
+static void fetch_files(const struct batch *batch)
+{
+	struct file *files = calloc(batch->paths_num, sizeof(*files));
+	struct stat st;
+
+	if (!files)
+		return;
+
+	for (uint16_t i = 0; i < batch->paths_num; ++i) {
+		struct file *file = &files[i];
+
+		if ((file->fd = open(batch->paths[i], O_RDONLY)) < 0) {
+			continue;
+		} else if (fstat(file->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+			close(file->fd);
+			file->fd = -1;
+			continue;
+		}
+
+		file->size = st.st_size;
+	}
+
+	if (!read_files(files, batch->paths_num)) {
+		for (uint16_t i = 0; i < batch->paths_num; ++i) {
+			if (files[i].fd >= 0)
+				posix_fadvise(files[i].fd, 0, 0,
+				  POSIX_FADV_WILLNEED);
+		}
+	}
+
+	for (uint16_t i = 0; i < batch->paths_num; ++i) {
+		if (files[i].fd >= 0)
+			close(files[i].fd);
+	}
+
+	free(files);
+}
+
+/* map pages into asset mapping so that first access does not fault */
+
+static void touch_pages(const struct asset_info *ainfo, long page)
+{
+	uintptr_t start = (uintptr_t) ainfo->buf & ~(uintptr_t) (page - 1);
+	const volatile uint8_t *ptr = ainfo->buf;
+	const volatile uint8_t *end = ptr + ainfo->len;
+
+	if (!ainfo->len)
+		return;
+
+	madvise((void *) start, (uintptr_t) end - start, MADV_WILLNEED);
+
+	for (; ptr < end; ptr += page)
+		(void) *ptr;
+
+	(void) end[-1];
+}
+
+static void run_batch(struct batch *batch)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	fetch_files(batch);
+
+	for (uint16_t i = 0; i < batch->paths_num; ++i) {
+		struct asset_info ainfo;
+		uint8_t ok;
+
+		if ((ok = get_asset(batch->paths[i], &ainfo, batch->amgr))) {
+			touch_pages(&ainfo, page);
+			put_asset(&ainfo); /* cache keeps it while budget allows */
+		}
+
+		if (batch->done)
+			batch->done(batch->paths[i], ok, batch->data);
+	}
+
+	dd("prefetched %u assets\n", batch->paths_num);
+}
+
+static void cancel_batch(struct batch *batch)
+{
+	for (uint16_t i = 0; batch->done && i < batch->paths_num; ++i)
+		batch->done(batch->paths[i], 0, batch->data);
+}
+
+static void free_batch(struct batch *batch)
+{
+	for (uint16_t i = 0; i < batch->paths_num; ++i)
+		free(batch->paths[i]);
+
+	free(batch);
+}
+
+static void *io_thread(void *arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&engine.lock);
+
+	while (!engine.stop) {
+		if (list_empty(&engine.pending)) {
+			pthread_cond_wait(&engine.cond, &engine.lock);
+			continue;
+		}
+
+		struct batch *batch = container_of(engine.pending.next,
+		  struct batch, head);
+
+		list_del(&batch->head);
+		pthread_mutex_unlock(&engine.lock);
+
+		run_batch(batch);
+		free_batch(batch);
+
+		pthread_mutex_lock(&engine.lock);
+	}
+
+	pthread_mutex_unlock(&engine.lock);
+	return NULL;
+}
+
+uint8_t asset_prefetch(const char *const paths[], uint16_t n,
+  const void *amgr, void (*done)(const char *path, uint8_t ok, void *data),
+  void *data)
+{
+	struct batch *batch = calloc(1, sizeof(*batch) + n * sizeof(char *));
+	uint8_t ret = 1;
+
+	if (!batch) {
+		ee("failed to allocate prefetch batch of %u\n", n);
+		return 0;
+	}
+
+	batch->amgr = amgr;
+	batch->done = done;
+	batch->data = data;
+
+	for (; batch->paths_num < n; ++batch->paths_num) {
+		if (!(batch->paths[batch->paths_num] =
+		  strdup(paths[batch->paths_num]))) {
+			ee("failed to copy prefetch paths\n");
+			free_batch(batch);
+			return 0;
+		}
+	}
+
+	pthread_mutex_lock(&engine.lock);
+
+	if (!engine.started && pthread_create(&engine.thread, NULL,
+	  io_thread, NULL) != 0) {
+		ee("failed to start prefetch thread\n");
+		ret = 0;
+	} else {
+		engine.started = 1;
+		engine.stop = 0;
+		list_add(&engine.pending, &batch->head);
+		pthread_cond_signal(&engine.cond);
+	}
+
+	pthread_mutex_unlock(&engine.lock);
+
+	if (!ret)
+		free_batch(batch);
+
+	return ret;
+}
+
+void prefetch_stop(void)
+{
+	struct list_head *cur;
+	struct list_head *tmp;
+	struct list_head pending;
+
+	pthread_mutex_lock(&engine.lock);
+
+	if (!engine.started) {
+		pthread_mutex_unlock(&engine.lock);
+		return;
+	}
+
+	engine.stop = 1;
+	list_init(&pending);
+
+	list_walk_safe(cur, tmp, &engine.pending) {
+		list_del(cur);
+		list_add(&pending, cur);
+	}
+
+	pthread_cond_signal(&engine.cond);
+	pthread_mutex_unlock(&engine.lock);
+
+	pthread_join(engine.thread, NULL); /* batch in progress finishes */
+	engine.started = 0;
+
+	list_walk_safe(cur, tmp, &pending) {
+		struct batch *batch = container_of(cur, struct batch, head);
+
+		cancel_batch(batch);
+		free_batch(batch);
+	}
+}
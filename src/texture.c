@@ -0,0 +1,696 @@
+/* texture.c: process wide texture registry
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define TAG "texture"
+
+#include <rgu/log.h>
+#include <rgu/utils.h>
+#include <rgu/cook.h>
+#include <rgu/etc.h>
+#include <rgu/dither.h>
+#include <rgu/decoder.h>
+#include <rgu/texture.h>
+
+#define BUCKETS 256 /* power of two */
+#define DEFAULT_PATH ""
+
+#define CACHE_MAGIC 0x54554752 /* RGUT */
+#define CACHE_VERSION 2
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t size;
+	uint8_t planes;
+	uint8_t format;
+	uint8_t levels;
+	uint8_t reserved;
+	struct mip_level level[MIP_MAX_LEVELS];
+};
+
+struct texture {
+	char *path;
+	GLuint id;
+	uint32_t refs;
+	uint32_t bytes;
+	struct texture *next_path; /* bucket chain by path */
+	struct texture *next_id; /* bucket chain by id */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct texture *by_path[BUCKETS];
+	struct texture *by_id[BUCKETS];
+	struct texture_stats stats;
+	struct texture_policy policy;
+} registry = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline uint32_t path_hash(const char *path)
+{
+	uint32_t h = 2166136261u; /* fnv-1a */
+
+	while (*path)
+		h = (h ^ (uint8_t) *path++) * 16777619u;
+
+	return h & (BUCKETS - 1);
+}
+
+static inline uint32_t id_hash(GLuint id)
+{
+	return (id * 2654435761u) >> 24 & (BUCKETS - 1);
+}
+
+static struct texture *find_path(const char *path)
+{
+	struct texture *tex = registry.by_path[path_hash(path)];
+
+	while (tex && strcmp(tex->path, path) != 0)
+		tex = tex->next_path;
+
+	return tex;
+}
+
+static struct texture **find_id(GLuint id)
+{
+	struct texture **tex = &registry.by_id[id_hash(id)];
+
+	while (*tex && (*tex)->id != id)
+		tex = &(*tex)->next_id;
+
+	return tex;
+}
+
+/* gles2 allows mipmaps of npot textures only with extension */
+
+static uint8_t mipmap_allowed(uint16_t w, uint16_t h)
+{
+	static int8_t npot = -1;
+
+	if (pot(w) && pot(h))
+		return 1;
+	else if (npot < 0)
+		npot = gl_extension("GL_OES_texture_npot");
+
+	return npot;
+}
+
+static uint8_t etc1_supported(void)
+{
+	static int8_t etc1 = -1;
+
+	if (etc1 < 0)
+		etc1 = gl_extension("GL_OES_compressed_ETC1_RGB8_texture");
+
+	return etc1;
+}
+
+static void gl_format(const struct mip_chain *chain, uint32_t *fmt,
+  uint32_t *type)
+{
+	*type = GL_UNSIGNED_BYTE;
+
+	switch (chain->format) {
+	case MIP_RGB565:
+		*fmt = GL_RGB;
+		*type = GL_UNSIGNED_SHORT_5_6_5;
+		break;
+	case MIP_RGBA4444:
+		*fmt = GL_RGBA;
+		*type = GL_UNSIGNED_SHORT_4_4_4_4;
+		break;
+	case MIP_RGBA5551:
+		*fmt = GL_RGBA;
+		*type = GL_UNSIGNED_SHORT_5_5_5_1;
+		break;
+	case MIP_L8:
+		*fmt = GL_LUMINANCE;
+		break;
+	case MIP_LA8:
+		*fmt = GL_LUMINANCE_ALPHA;
+		break;
+	default:
+		*fmt = chain->planes == 4 ? GL_RGBA : GL_RGB;
+		break;
+	}
+}
+
+static GLuint generate_texture(const struct mip_chain *chain, uint32_t *bytes)
+{
+	const struct mip_level *base = &chain->level[0];
+	uint32_t fmt;
+	uint32_t type;
+	uint8_t levels = mipmap_allowed(base->w, base->h) ? chain->levels : 1;
+	GLuint tex;
+
+	gl_format(chain, &fmt, &type);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ?
+	  GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); /* rgb rows are not padded */
+
+	*bytes = 0;
+
+	for (uint8_t i = 0; i < levels; ++i) {
+		const struct mip_level *level = &chain->level[i];
+
+		if (chain->format == MIP_ETC1)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, GL_ETC1_RGB8_OES,
+			  level->w, level->h, 0, level->size,
+			  chain->data + level->offset);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, fmt, level->w, level->h,
+			  0, fmt, type, chain->data + level->offset);
+
+		*bytes += level->size;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	dd("texture %u fmt %u type %u mip format %u wh { %u %u } levels %u/%u\n",
+	  tex, fmt, type, chain->format, base->w, base->h, levels,
+	  chain->levels);
+
+	return tex;
+}
+
+/* widen grey and grey-alpha images to rgb and rgba */
+
+static uint8_t *expand_grey(const uint8_t *src, uint32_t texels,
+  uint8_t planes)
+{
+	uint8_t *buf = malloc(texels * (planes + 2));
+	uint8_t *dst = buf;
+
+	if (!buf)
+		return NULL;
+
+	for (uint32_t i = 0; i < texels; ++i, src += planes) {
+		*dst++ = src[0];
+		*dst++ = src[0];
+		*dst++ = src[0];
+
+		if (planes == 2)
+			*dst++ = src[1];
+	}
+
+	return buf;
+}
+
+static uint8_t opaque(const struct mip_chain *chain)
+{
+	const uint8_t *ptr = chain->data;
+	const uint8_t *end = ptr + chain->level[0].size;
+
+	if (chain->planes == 3)
+		return 1;
+
+	for (ptr += 3; ptr < end; ptr += 4) {
+		if (*ptr != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+static uint8_t grey(const struct mip_chain *chain)
+{
+	const uint8_t *ptr = chain->data;
+	const uint8_t *end = ptr + chain->level[0].size;
+
+	for (; ptr < end; ptr += chain->planes) {
+		if (ptr[0] != ptr[1] || ptr[0] != ptr[2])
+			return 0;
+	}
+
+	return 1;
+}
+
+static inline uint8_t format16(uint8_t format)
+{
+	return format >= MIP_RGB565 && format <= MIP_RGBA5551;
+}
+
+/* etc1 has no alpha, so only opaque chains are compressed; 16-bit formats
+ * are used where etc1 is not */
+
+static uint8_t policy_format(const struct mip_chain *chain)
+{
+	const struct texture_policy *policy = &registry.policy;
+	uint8_t solid = opaque(chain);
+
+	if (policy->luminance && grey(chain))
+		return solid ? MIP_L8 : MIP_LA8;
+	else if (solid && policy->compress)
+		return MIP_ETC1;
+	else if (solid && format16(policy->opaque_format))
+		return policy->opaque_format;
+	else if (!solid && format16(policy->alpha_format) &&
+	  policy->alpha_format != MIP_RGB565)
+		return policy->alpha_format;
+
+	return MIP_RAW;
+}
+
+static uint8_t format_planes(uint8_t format, uint8_t planes)
+{
+	switch (format) {
+	case MIP_ETC1:
+	case MIP_RGB565:
+		return 3;
+	case MIP_RGBA4444:
+	case MIP_RGBA5551:
+		return 4;
+	case MIP_L8:
+		return 1;
+	case MIP_LA8:
+		return 2;
+	default:
+		return planes;
+	}
+}
+
+static uint32_t level_size(uint8_t format, uint8_t planes, uint16_t w,
+  uint16_t h)
+{
+	if (format == MIP_ETC1)
+		return etc1_size(w, h);
+	else if (format16(format))
+		return (uint32_t) w * h * sizeof(uint16_t);
+	else
+		return (uint32_t) w * h * planes;
+}
+
+static void take_grey(const uint8_t *src, uint32_t texels, uint8_t planes,
+  uint8_t *dst)
+{
+	for (uint32_t i = 0; i < texels; ++i, src += planes) {
+		*dst++ = src[0];
+
+		if (planes == 4)
+			*dst++ = src[3];
+	}
+}
+
+static uint8_t convert_level(const struct mip_chain *chain,
+  const struct mip_level *src, uint8_t format, uint8_t *dst)
+{
+	const uint8_t *data = chain->data + src->offset;
+
+	switch (format) {
+	case MIP_ETC1:
+		etc1_encode(data, src->w, src->h, chain->planes, dst);
+		return 1;
+	case MIP_RAW: /* from etc1 only */
+		etc1_decode(data, src->w, src->h, dst);
+		return 1;
+	case MIP_L8:
+	case MIP_LA8:
+		take_grey(data, (uint32_t) src->w * src->h, chain->planes, dst);
+		return 1;
+	default:
+		return dither_pack16(data, src->w, src->h, chain->planes,
+		  format, registry.policy.dither, (uint16_t *) dst);
+	}
+}
+
+static uint8_t convert_chain(struct mip_chain *chain, uint8_t format)
+{
+	struct mip_chain res = *chain;
+	uint32_t size = 0;
+
+	res.format = format;
+	res.planes = format_planes(format, chain->planes);
+
+	for (uint8_t i = 0; i < res.levels; ++i) {
+		struct mip_level *level = &res.level[i];
+
+		level->offset = size;
+		level->size = level_size(format, res.planes, level->w, level->h);
+		size += level->size;
+	}
+
+	if (!(res.data = malloc(size))) {
+		ee("failed to allocate %u bytes for texture\n", size);
+		return 0;
+	}
+
+	res.size = size;
+
+	for (uint8_t i = 0; i < res.levels; ++i) {
+		if (!convert_level(chain, &chain->level[i], format,
+		  res.data + res.level[i].offset)) {
+			free(res.data);
+			return 0;
+		}
+	}
+
+	mip_free(chain);
+	*chain = res;
+
+	return 1;
+}
+
+static uint8_t load_cached(const char *path, uint64_t key,
+  struct mip_chain *chain)
+{
+	struct cache_header hdr;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "rb")))
+		return 0;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != CACHE_MAGIC ||
+	  hdr.version != CACHE_VERSION || hdr.key != key ||
+	  !hdr.levels || hdr.levels > MIP_MAX_LEVELS ||
+	  !(chain->data = malloc(hdr.size)) ||
+	  fread(chain->data, 1, hdr.size, fp) != hdr.size) {
+		ww("ignore stale or broken %s\n", path);
+		fclose(fp);
+		mip_free(chain);
+		return 0;
+	}
+
+	fclose(fp);
+
+	chain->size = hdr.size;
+	chain->planes = hdr.planes;
+	chain->format = hdr.format;
+	chain->levels = hdr.levels;
+	memcpy(chain->level, hdr.level, sizeof(chain->level));
+
+	return 1;
+}
+
+static void save_cached(const char *path, uint64_t key,
+  const struct mip_chain *chain)
+{
+	struct cache_header hdr = {0};
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	hdr.magic = CACHE_MAGIC;
+	hdr.version = CACHE_VERSION;
+	hdr.key = key;
+	hdr.size = chain->size;
+	hdr.planes = chain->planes;
+	hdr.format = chain->format;
+	hdr.levels = chain->levels;
+	memcpy(hdr.level, chain->level, sizeof(hdr.level));
+
+	/* decode workers of several loaders may race for same texture */
+	snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, getpid(),
+	  (unsigned long) pthread_self());
+
+	if (!(fp = fopen(tmp, "wb"))) {
+		ee("failed to create %s\n", tmp);
+		return;
+	}
+
+	uint8_t ret = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	  fwrite(chain->data, 1, chain->size, fp) == chain->size;
+
+	if (fclose(fp) != 0 || !ret || rename(tmp, path) < 0) {
+		ee("failed to write %s\n", path);
+		unlink(tmp);
+	}
+}
+
+static uint8_t decode_chain(const char *path, struct asset_info *ainfo,
+  struct mip_chain *chain)
+{
+	struct image image;
+	uint8_t ret = 0;
+
+	if (!image_decode(ainfo, &image)) {
+		ee("failed to decode texture %s\n", path);
+		return 0;
+	}
+
+	if (image.format == GL_LUMINANCE || image.format == GL_LUMINANCE_ALPHA) {
+		uint8_t planes = image.format == GL_LUMINANCE ? 1 : 2;
+		uint8_t *rgb = expand_grey(image.data, image.w * image.h, planes);
+
+		if (rgb)
+			ret = mip_build(rgb, image.w, image.h, planes + 2, 0,
+			  chain);
+
+		free(rgb);
+	} else {
+		ret = mip_build(image.data, image.w, image.h,
+		  image.format == GL_RGB ? 3 : 4, 0, chain);
+	}
+
+	image_release(&image);
+
+	uint8_t format = ret ? policy_format(chain) : MIP_RAW;
+
+	if (format != MIP_RAW)
+		convert_chain(chain, format); /* keep raw chain on failure */
+
+	return ret;
+}
+
+uint8_t texture_decode(const char *path, const void *amgr,
+  struct mip_chain *chain)
+{
+	const struct texture_policy *policy = &registry.policy;
+	struct asset_info ainfo;
+	char cached[PATH_MAX];
+	uint64_t key = 0;
+
+	memset(chain, 0, sizeof(*chain));
+	cached[0] = '\0';
+
+	if (!get_asset(path, &ainfo, amgr))
+		return 0;
+
+	if (policy->cache_dir) {
+		uint8_t opts[] = { policy->compress, policy->opaque_format,
+		  policy->alpha_format, policy->dither, policy->luminance };
+
+		key = cook_hash(ainfo.buf, ainfo.len, CACHE_VERSION);
+		key = cook_hash(opts, sizeof(opts), key);
+		snprintf(cached, sizeof(cached), "%s/%016llx.tex",
+		  policy->cache_dir, (unsigned long long) key);
+	}
+
+	if (cached[0] && load_cached(cached, key, chain)) {
+		put_asset(&ainfo);
+		dd("use cached %s for %s\n", cached, path);
+		return 1;
+	}
+
+	uint8_t ret = decode_chain(path, &ainfo, chain);
+
+	put_asset(&ainfo);
+
+	if (ret && cached[0])
+		save_cached(cached, key, chain);
+
+	return ret;
+}
+
+void texture_set_policy(const struct texture_policy *policy)
+{
+	registry.policy = *policy;
+}
+
+static struct texture *add_texture(const char *path, GLuint id,
+  uint32_t bytes)
+{
+	struct texture *tex = calloc(1, sizeof(*tex));
+
+	if (!tex || !(tex->path = strdup(path))) {
+		ee("failed to allocate texture %s\n", path);
+		free(tex);
+		return NULL;
+	}
+
+	tex->id = id;
+	tex->refs = 1;
+	tex->bytes = bytes;
+
+	uint32_t h = path_hash(path);
+
+	pthread_mutex_lock(&registry.lock);
+	tex->next_path = registry.by_path[h];
+	registry.by_path[h] = tex;
+	*find_id(id) = tex;
+	registry.stats.textures++;
+	registry.stats.bytes += bytes;
+	pthread_mutex_unlock(&registry.lock);
+
+	return tex;
+}
+
+static GLuint default_texture(void)
+{
+	struct texture *tex;
+	struct mip_chain chain;
+	uint32_t bytes;
+	uint8_t rgb[3] = { 0xff, 0xff, 0xff };
+
+	pthread_mutex_lock(&registry.lock);
+
+	if ((tex = find_path(DEFAULT_PATH)))
+		tex->refs++;
+
+	pthread_mutex_unlock(&registry.lock);
+
+	if (tex)
+		return tex->id;
+
+	if (!mip_build(rgb, 1, 1, sizeof(rgb), 1, &chain))
+		return 0;
+
+	GLuint id = generate_texture(&chain, &bytes);
+
+	mip_free(&chain);
+	ii("default texture %u | color { %u %u %u }\n", id, rgb[0], rgb[1],
+	  rgb[2]);
+
+	if (!add_texture(DEFAULT_PATH, id, bytes)) {
+		glDeleteTextures(1, &id);
+		return 0;
+	}
+
+	return id;
+}
+
+GLuint texture_acquire(const char *path, const void *amgr,
+  struct mip_chain *chain)
+{
+	struct mip_chain tmp;
+	struct texture *tex;
+	char key[PATH_MAX];
+
+	if (path)
+		normalize_path(path, key, sizeof(key));
+
+	if (!path || !key[0]) {
+		if (chain)
+			mip_free(chain);
+
+		return default_texture();
+	}
+
+	pthread_mutex_lock(&registry.lock);
+
+	if ((tex = find_path(key))) {
+		tex->refs++;
+		registry.stats.hits++;
+	} else {
+		registry.stats.misses++;
+	}
+
+	pthread_mutex_unlock(&registry.lock);
+
+	if (tex) {
+		if (chain)
+			mip_free(chain);
+
+		dd("reuse texture %u %s\n", tex->id, key);
+		return tex->id;
+	}
+
+	if (!chain) {
+		chain = &tmp;
+		texture_decode(key, amgr, chain);
+	}
+
+	if (!chain->data) {
+		ww("failed to load texture %s, use default one\n", key);
+		return default_texture();
+	} else if (chain->format == MIP_ETC1 && !etc1_supported() &&
+	  !convert_chain(chain, MIP_RAW)) {
+		mip_free(chain);
+		return default_texture();
+	}
+
+	uint32_t bytes;
+	GLuint id = generate_texture(chain, &bytes);
+
+	mip_free(chain);
+
+	if (!add_texture(key, id, bytes)) {
+		glDeleteTextures(1, &id);
+		return default_texture();
+	}
+
+	ii("use texture %u %s\n", id, key);
+
+	return id;
+}
+
+void texture_release(GLuint id)
+{
+	struct texture *tex;
+
+	if (!id)
+		return;
+
+	pthread_mutex_lock(&registry.lock);
+
+	struct texture **slot = find_id(id);
+
+	if (!(tex = *slot) || --tex->refs) {
+		pthread_mutex_unlock(&registry.lock);
+		return;
+	}
+
+	*slot = tex->next_id;
+
+	struct texture **cur = &registry.by_path[path_hash(tex->path)];
+
+	while (*cur != tex)
+		cur = &(*cur)->next_path;
+
+	*cur = tex->next_path;
+	registry.stats.textures--;
+	registry.stats.bytes -= tex->bytes;
+
+	pthread_mutex_unlock(&registry.lock);
+
+	dd("delete texture %u %s\n", tex->id, tex->path);
+
+	glDeleteTextures(1, &tex->id);
+	free(tex->path);
+	free(tex);
+}
+
+uint8_t texture_cached(const char *path)
+{
+	char key[PATH_MAX];
+
+	normalize_path(path, key, sizeof(key));
+
+	pthread_mutex_lock(&registry.lock);
+	uint8_t ret = !!find_path(key);
+	pthread_mutex_unlock(&registry.lock);
+
+	return ret;
+}
+
+void texture_stats(struct texture_stats *stats)
+{
+	pthread_mutex_lock(&registry.lock);
+	*stats = registry.stats;
+	pthread_mutex_unlock(&registry.lock);
+}
@@ -0,0 +1,199 @@
+/* token.c: text tokenizer helpers
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <rgu/token.h>
+
+#if defined(__AVX2__)
+const char *tok_eol(const char *ptr, const char *end)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+
+	while (end - ptr >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) ptr);
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+
+		if (mask)
+			return ptr + __builtin_ctz(mask);
+
+		ptr += 32;
+	}
+
+	while (ptr < end && *ptr != '\n')
+		ptr++;
+
+	return ptr;
+}
+#elif defined(__SSE2__)
+const char *tok_eol(const char *ptr, const char *end)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	while (end - ptr >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) ptr);
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+		if (mask)
+			return ptr + __builtin_ctz(mask);
+
+		ptr += 16;
+	}
+
+	while (ptr < end && *ptr != '\n')
+		ptr++;
+
+	return ptr;
+}
+#elif defined(__ARM_NEON)
+const char *tok_eol(const char *ptr, const char *end)
+{
+	const uint8x16_t nl = vdupq_n_u8('\n');
+
+	while (end - ptr >= 16) {
+		uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *) ptr), nl);
+		/* narrow 16 bytes of 0x00/0xff to 16 nibbles */
+		uint8x8_t res = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(res), 0);
+
+		if (mask)
+			return ptr + (__builtin_ctzll(mask) >> 2);
+
+		ptr += 16;
+	}
+
+	while (ptr < end && *ptr != '\n')
+		ptr++;
+
+	return ptr;
+}
+#else
+const char *tok_eol(const char *ptr, const char *end)
+{
+	const char *eol = memchr(ptr, '\n', end - ptr);
+
+	return eol ? eol : end;
+}
+#endif
+
+static const double pow10_[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_DIGITS 19 /* fits uint64_t */
+#define MAX_POW10 22 /* exactly representable in double */
+
+const char *tok_float(const char *ptr, const char *end, float *val)
+{
+	uint64_t mant = 0;
+	int32_t exp = 0;
+	uint8_t digits = 0;
+	uint8_t neg = 0;
+
+	ptr = tok_skip(ptr, end);
+
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		neg = *ptr++ == '-';
+
+	const char *start = ptr;
+
+	for (; ptr < end && (uint8_t) (*ptr - '0') < 10; ++ptr) {
+		if (digits < MAX_DIGITS) {
+			mant = mant * 10 + (*ptr - '0');
+			digits += !!mant;
+		} else {
+			exp++;
+		}
+	}
+
+	if (ptr < end && *ptr == '.') {
+		ptr++;
+
+		for (; ptr < end && (uint8_t) (*ptr - '0') < 10; ++ptr) {
+			if (digits < MAX_DIGITS) {
+				mant = mant * 10 + (*ptr - '0');
+				digits += !!mant;
+				exp--;
+			}
+		}
+	}
+
+	if (ptr == start || (ptr == start + 1 && *start == '.'))
+		return NULL;
+
+	if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+		const char *tmp = ptr + 1;
+		int32_t e = 0;
+		uint8_t eneg = 0;
+
+		if (tmp < end && (*tmp == '-' || *tmp == '+'))
+			eneg = *tmp++ == '-';
+
+		if (tmp < end && (uint8_t) (*tmp - '0') < 10) {
+			for (; tmp < end && (uint8_t) (*tmp - '0') < 10; ++tmp)
+				if (e < 10000)
+					e = e * 10 + (*tmp - '0');
+
+			exp += eneg ? -e : e;
+			ptr = tmp;
+		}
+	}
+
+	double d = mant;
+
+	while (exp > MAX_POW10) {
+		d *= pow10_[MAX_POW10];
+		exp -= MAX_POW10;
+	}
+
+	while (exp < -MAX_POW10) {
+		d /= pow10_[MAX_POW10];
+		exp += MAX_POW10;
+	}
+
+	if (exp >= 0)
+		d *= pow10_[exp];
+	else
+		d /= pow10_[-exp];
+
+	*val = neg ? -d : d;
+	return ptr;
+}
+
+const char *tok_int(const char *ptr, const char *end, int32_t *val)
+{
+	int64_t res = 0;
+	uint8_t neg = 0;
+
+	ptr = tok_skip(ptr, end);
+
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		neg = *ptr++ == '-';
+
+	const char *start = ptr;
+
+	for (; ptr < end && (uint8_t) (*ptr - '0') < 10; ++ptr)
+		if (res <= INT32_MAX)
+			res = res * 10 + (*ptr - '0');
+
+	if (ptr == start)
+		return NULL;
+
+	if (res > INT32_MAX)
+		res = INT32_MAX;
+
+	*val = neg ? -res : res;
+	return ptr;
+}
@@ -7,7 +7,13 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
 #include <libgen.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define TAG "wfobj"
 
@@ -18,19 +24,27 @@
 #include <rgu/time.h>
 #include <rgu/gl.h>
 #include <rgu/gm.h>
+#include <rgu/token.h>
+#include <rgu/cook.h>
+#include <rgu/mesh.h>
+#include <rgu/texture.h>
+#include <rgu/atlas.h>
 #include <rgu/wfobj.h>
 
-#define MAX_INDEX 100000
-
-#define strip_str(str) {\
-	uint8_t pos = strlen(str) - 1;\
-	if (str[pos] == '\n' || str[pos] == '\r')\
-	str[pos] = '\0';\
-}
+#define MAX_INDEX16 UINT16_MAX
+#define LINE_LEN_HINT 64 /* to size component arrays from buffer length */
+#define MIN_CHUNK_LEN (1 << 16)
+#define MAX_DECODE_THREADS 8
+#define MAX_ATLASES 8
+#define ATLAS_PADDING 4 /* gutter texels around each packed texture */
+#define ATLAS_LEVELS 3 /* deeper levels would blend texels across gutters */
+#define UV_EPSILON 1e-3f
 
 struct context {
 	const void *amgr;
 	uint16_t shapes_num;
+	struct cooked cooked;
+	struct loader *loader;
 };
 
 struct texlib_item {
@@ -47,19 +61,16 @@ struct texlib {
 
 #define texlib_item(item) container_of(item, struct texlib_item, head)
 
-struct texture_info {
-	GLuint id;
-	const char *name;
-	struct list_head head;
-};
+/* texture decoded ahead of upload; chain data is NULL if decoding failed */
 
-struct texture_cache {
-	GLuint deftex;
-	struct list_head textures;
-	struct context *ctx;
+struct texture_image {
+	char *name;
+	struct mip_chain chain;
+	atomic_uchar ready; /* set once decoding is over */
+	struct list_head head;
 };
 
-#define texcache_item(item) container_of(item, struct texture_info, head)
+#define teximage_item(item) container_of(item, struct texture_image, head)
 
 struct shape_info {
 	const char *name;
@@ -67,541 +78,1505 @@ struct shape_info {
 
 	float *vertices;
 	uint32_t vertices_idx;
+	uint32_t vertices_max;
 
 	float *colors;
 	uint32_t colors_idx;
+	uint32_t colors_max;
 
-	uint16_t *vertex_indices;
+	uint32_t *vertex_indices;
 	uint32_t vertex_indices_idx;
+	uint32_t vertex_indices_max;
+	uint32_t vertex_indices_start;
 
 	float *normals;
 	uint32_t normals_idx;
+	uint32_t normals_max;
 
-	uint16_t *normal_indices;
+	uint32_t *normal_indices;
 	uint32_t normal_indices_idx;
+	uint32_t normal_indices_max;
+	uint32_t normal_indices_start;
 
 	float *uvs;
 	uint32_t uvs_idx;
+	uint32_t uvs_max;
 
-	uint16_t *uv_indices;
+	uint32_t *uv_indices;
 	uint32_t uv_indices_idx;
+	uint32_t uv_indices_max;
+	uint32_t uv_indices_start;
 
 	struct context *ctx;
 };
 
-static GLuint default_texture(void)
+enum {
+	MARK_NAME,
+	MARK_MTLLIB,
+	MARK_USEMTL,
+};
+
+/* 'o'/'g', 'mtllib' and 'usemtl' directives are recorded with index counts
+ * seen so far and replayed in file order once all chunks are parsed */
+
+struct mark {
+	uint8_t type;
+	const char *str;
+	uint32_t len;
+	uint32_t vertex_indices_idx;
+	uint32_t normal_indices_idx;
+	uint32_t uv_indices_idx;
+};
+
+struct chunk {
+	const char *buf;
+	const char *end;
+	struct model *model;
+	struct shape_info info;
+	struct mark *marks;
+	uint32_t marks_num;
+	uint32_t marks_max;
+	uint8_t ret;
+	pthread_t thread;
+};
+
+enum {
+	LOAD_PARSE,
+	LOAD_MERGE,
+	LOAD_SHAPES,
+	LOAD_PACK,
+	LOAD_TEXTURES,
+	LOAD_PREPARED,
+	LOAD_UPLOAD,
+	LOAD_DONE,
+};
+
+/* model loading state kept between steps */
+
+struct loader {
+	uint8_t stage;
+	uint8_t incremental;
+	uint32_t start_time;
+
+	struct asset_info ainfo;
+	char cooked[PATH_MAX];
+	uint64_t key;
+
+	struct chunk *chunks;
+	uint8_t chunks_num;
+	uint8_t chunk; /* next chunk to parse or replay */
+	uint32_t mark; /* next mark to replay */
+	uint32_t indices_end[3]; /* vertex, normal and uv indices in file */
+	struct shape_info info;
+	struct texlib texlib;
+
+	struct list_head *shape; /* next shape to pack, decode or upload */
+	struct list_head images; /* decoded textures, see struct texture_image */
+	uint32_t array_bytes;
+	uint32_t indices_bytes;
+	uint32_t decode_ms;
+	float decode_speedup; /* summed decode time over wall time */
+	struct decode_pool *pool;
+	uint16_t pending; /* shapes bound to placeholder texture */
+};
+
+static struct texture_image *find_image(struct loader *ld, const char *name)
 {
-	GLuint tex;
-	uint32_t fmt = GL_RGB;
-	uint8_t rgb[3] = { 0xff, 0xff, 0xff };
+	struct list_head *cur;
+
+	if (!ld || !ld->images.next)
+		return NULL;
 
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, fmt, 1, 1, 0, fmt, GL_UNSIGNED_BYTE, rgb);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	list_walk(cur, &ld->images) {
+		struct texture_image *img = teximage_item(cur);
 
-	ii("default texture %u | color { %u %u %u }\n", tex, rgb[0], rgb[1], rgb[2]);
+		if (strcmp(name, img->name) == 0)
+			return img;
+	}
 
-	return tex;
+	return NULL;
 }
 
-static GLuint generate_texture(void *data, uint16_t w, uint16_t h, uint32_t fmt)
+static struct texture_image *add_image(struct loader *ld, const char *path)
 {
-	GLuint tex;
+	struct texture_image *img;
 
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE, data);
+	if (!path || find_image(ld, path) || texture_cached(path))
+		return NULL;
 
-	dd("texture %u fmt %u wh { %u %u } data %p\n", tex, fmt, w, h, data);
+	if (!(img = calloc(1, sizeof(*img))) || !(img->name = strdup(path))) {
+		ee("failed to allocate memory for texture image\n");
+		free(img);
+		return NULL;
+	}
 
-	return tex;
+	atomic_init(&img->ready, 0);
+	list_add(&ld->images, &img->head);
+	return img;
 }
 
-static GLuint load_texture(const char *path, struct texture_cache *cache)
+static inline uint8_t image_ready(struct texture_image *img)
 {
-	if (!path)
-		return cache->deftex;
+	return atomic_load_explicit(&img->ready, memory_order_acquire);
+}
 
-	struct list_head *cur;
-	struct texture_info *texinfo;
+/* gl is not touched here so it can run on any thread */
 
-	list_walk(cur, &cache->textures) {
-		texinfo = texcache_item(cur);
+static void decode_image(struct texture_image *img, const void *amgr)
+{
+	texture_decode(img->name, amgr, &img->chain);
 
-		if (strcmp(path, texinfo->name) == 0)
-			return texinfo->id;
-	}
+	dd("decoded texture %s | %ux%u planes %u levels %u\n", img->name,
+	  img->chain.level[0].w, img->chain.level[0].h, img->chain.planes,
+	  img->chain.levels);
 
-	struct asset_info ainfo;
-	struct image_info iinfo;
+	atomic_store_explicit(&img->ready, 1, memory_order_release);
+}
 
-	if (!get_asset(path, &ainfo, cache->ctx->amgr))
-		return cache->deftex;
+/* decode texture of shape ahead of upload */
 
-	if (!get_image(&ainfo, &iinfo)) {
-		put_asset(&ainfo);
-		return cache->deftex;
-	}
+static void decode_texture(struct loader *ld, const char *path,
+  const void *amgr)
+{
+	struct texture_image *img = add_image(ld, path);
 
-	uint32_t fmt;
+	if (img)
+		decode_image(img, amgr);
+}
 
-	if (iinfo.planes == 3)
-		fmt = GL_RGB;
-	else if (iinfo.planes == 4)
-		fmt = GL_RGBA;
-	else
-		fmt = GL_RGB;
+struct decode_pool {
+	struct texture_image **images;
+	uint16_t images_num;
+	atomic_uint next;
+	atomic_uint busy_us; /* sum of per-image decode times */
+	const void *amgr;
+	pthread_t threads[MAX_DECODE_THREADS];
+	uint8_t threads_num;
+	uint64_t start_time;
+};
 
-	GLuint texid = generate_texture(iinfo.image, iinfo.w, iinfo.h, fmt);
+static void *decode_worker(void *arg)
+{
+	struct decode_pool *pool = arg;
+	uint32_t i;
 
-	put_image(&iinfo);
-	put_asset(&ainfo);
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->images_num) {
+		uint64_t start = time_us();
 
-	if (!(texinfo = calloc(1, sizeof(*texinfo)))) {
-		ee("failed to allocate memory for texture cache item\n");
-		glDeleteTextures(1, &texid);
-		return cache->deftex;
+		decode_image(pool->images[i], pool->amgr);
+		atomic_fetch_add(&pool->busy_us, time_us() - start);
 	}
 
-	texinfo->name = path;
-	texinfo->id = texid;
-	list_add(&cache->textures, &texinfo->head);
-
-	ii("use texture %u %s\n", texid, path);
-
-	return texid;
+	return NULL;
 }
 
-static inline void upload_shape(struct wfobj *shape,
-  struct texture_cache *cache)
+/* wait for workers; pending images are dropped if cancel is set */
+
+static void join_pool(struct loader *ld, uint8_t cancel)
 {
-	if (!shape->array_size || !shape->indices_num) {
-		ww("bad array or indices size: %u %u\n", shape->array_size,
-		  shape->indices_num);
+	struct decode_pool *pool = ld->pool;
+
+	if (!pool)
 		return;
-	}
 
-	glGenBuffers(1, &shape->vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, shape->vbo);
-	glBufferData(GL_ARRAY_BUFFER, shape->array_size * sizeof(float),
-	  shape->array, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (cancel)
+		atomic_store(&pool->next, pool->images_num);
 
-	glGenBuffers(1, &shape->ibo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape->ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	  shape->indices_num * sizeof(uint16_t), shape->indices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	for (uint8_t i = 0; i < pool->threads_num; ++i)
+		pthread_join(pool->threads[i], NULL);
 
-	shape->tex = load_texture(shape->texname, cache);
+	ld->decode_ms = (time_us() - pool->start_time) / 1000;
+	ld->decode_speedup = ld->decode_ms ?
+	  atomic_load(&pool->busy_us) / 1000.f / ld->decode_ms : 1;
 
-	ii("shape uploaded | vbo %u, %u elements | ibo %u, %u indices | tex %u | with color %u\n",
-	  shape->vbo, shape->array_size, shape->ibo, shape->indices_num,
-	  shape->tex, shape->with_color);
+	ii("decoded %u textures on %u workers in %u ms\n", pool->images_num,
+	  pool->threads_num, ld->decode_ms);
+
+	free(pool->images);
+	dealloc(ld->pool);
 }
 
-static uint8_t prepare_shape(struct model *model, struct shape_info *info)
+/* decode distinct textures of model on worker threads; without wait the
+ * calling thread returns at once and images become ready one by one */
+
+static void decode_textures(struct model *model, struct loader *ld,
+  uint8_t wait)
 {
-	if (info->normal_indices_idx &&
-	  (info->normal_indices_idx != info->vertex_indices_idx)) {
-		ee("normal and vertex indices mismatch | n %u != v %u\n",
-		  info->normal_indices_idx, info->vertex_indices_idx);
-		return 0;
-	}
+	struct context *ctx = (struct context *) model->ctx;
+	struct list_head *cur;
+	struct decode_pool *pool;
 
-	if (info->uv_indices_idx &&
-	  (info->uv_indices_idx != info->vertex_indices_idx)) {
-		ee("uv and vertex indices mismatch | uv %u != v %u\n",
-		  info->uv_indices_idx, info->vertex_indices_idx);
-		return 0;
+	if (!(pool = calloc(1, sizeof(*pool))) ||
+	  !(pool->images = calloc(ctx->shapes_num, sizeof(*pool->images)))) {
+		free(pool);
+		return;
 	}
 
-	ii("prepare shape '%s' : vi %u, ni %u, ti %u | v %.1f, n %.1f, uvs %.1f\n",
-	  info->name, info->vertex_indices_idx, info->normal_indices_idx,
-	  info->uv_indices_idx, info->vertices_idx / 3., info->normals_idx / 3.,
-	  info->uvs_idx / 2.);
-
-	struct wfobj *shape = calloc(1, sizeof(*shape));
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct texture_image *img = add_image(ld, shape->texname);
 
-	if (!shape) {
-		ee("failed to allocate shape memory\n");
-		return 0;
+		if (img && pool->images_num < ctx->shapes_num)
+			pool->images[pool->images_num++] = img;
 	}
 
-	uint32_t size;
+	if (!pool->images_num) {
+		free(pool->images);
+		free(pool);
+		return;
+	}
 
-	size = info->vertex_indices_idx * sizeof(*info->vertices) * 3;
-	size += info->normal_indices_idx * sizeof(*info->normals) * 3;
-	size += info->uv_indices_idx * sizeof(*info->uvs) * 2;
+	pool->amgr = ctx->amgr;
+	pool->start_time = time_us();
+	atomic_init(&pool->next, 0);
+	atomic_init(&pool->busy_us, 0);
+	ld->pool = pool;
 
-	if (info->colors_idx)
-		size += info->vertex_indices_idx * sizeof(*info->colors) * 3;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint8_t num = cpus > 0 ? (cpus < MAX_DECODE_THREADS ? cpus :
+	  MAX_DECODE_THREADS) : 1;
 
-	if (!(shape->array = malloc(size))) {
-		ee("failed to allocate %u bytes for shape '%s'\n",
-		  size, shape->name);
-		return 0;
-	}
+	if (num > pool->images_num)
+		num = pool->images_num;
 
-	size = info->vertex_indices_idx * sizeof(*shape->indices);
+	for (uint8_t i = wait; i < num; ++i) { /* waiting thread helps out */
+		if (pthread_create(&pool->threads[pool->threads_num], NULL,
+		  decode_worker, pool) != 0)
+			break;
 
-	if (!(shape->indices = malloc(size))) {
-		ee("failed to allocate %u bytes for shape '%s'\n",
-		  size, shape->name);
-		dealloc(shape->array);
-		return 0;
+		pool->threads_num++;
 	}
 
-	struct context *ctx = (struct context *) model->ctx;
+	if (wait || !pool->threads_num) {
+		decode_worker(pool);
+		join_pool(ld, 0);
+	}
+}
 
-	shape->id = ctx->shapes_num++;
-	shape->name = strdup(info->name);
-	shape->visible = 1;
-	shape->with_color = !!info->colors_idx;
+/* take registry reference, handing over image decoded ahead if any */
 
-	if (info->texname) {
-		shape->texname = strdup(info->texname);
-		info->texname = NULL;
-	}
+static GLuint load_texture(const char *path, struct context *ctx)
+{
+	struct texture_image *img = path ? find_image(ctx->loader, path) : NULL;
+	struct mip_chain chain;
 
-	ii("shape '%s' id %u | vertex indices %u\n", shape->name, shape->id,
-	  info->vertex_indices_idx);
+	if (img && !image_ready(img))
+		return 0; /* still decoding, see model_update_textures() */
+	else if (!img)
+		return texture_acquire(path, ctx->amgr, NULL);
 
-	for (uint32_t i = 0; i < info->vertex_indices_idx; ++i) {
-		uint16_t vertex_index = info->vertex_indices[i];
-		float vx = info->vertices[vertex_index * 3];
-		float vy = info->vertices[vertex_index * 3 + 1];
-		float vz = info->vertices[vertex_index * 3 + 2];
+	chain = img->chain;
+	list_del(&img->head);
+	free(img->name);
+	free(img);
 
-		shape->array[shape->array_size++] = vx;
-		shape->array[shape->array_size++] = vy;
-		shape->array[shape->array_size++] = vz;
+	return texture_acquire(chain.data ? path : NULL, ctx->amgr, &chain);
+}
 
-		if (model->max.x < vx)
-			model->max.x = vx;
-		if (model->max.y < vy)
-			model->max.y = vy;
-		if (model->max.z < vz)
-			model->max.z = vz;
+struct atlas_entry {
+	struct texture_image *img;
+	uint8_t skip; /* wrapped uv or otherwise not packable */
+	uint8_t atlas;
+	uint16_t x;
+	uint16_t y;
+};
 
-		if (model->min.x > vx)
-			model->min.x = vx;
-		if (model->min.y > vy)
-			model->min.y = vy;
-		if (model->min.z > vz)
-			model->min.z = vz;
+static struct atlas_entry *find_entry(struct atlas_entry *entries,
+  uint16_t num, const char *name)
+{
+	for (uint16_t i = 0; name && i < num; ++i) {
+		if (strcmp(entries[i].img->name, name) == 0)
+			return &entries[i];
+	}
 
-		shape->indices[shape->indices_num++] = i;
+	return NULL;
+}
 
-		float nx;
-		float ny;
-		float nz;
+static int cmp_entries(const void *a, const void *b)
+{
+	const struct atlas_entry *ea = a;
+	const struct atlas_entry *eb = b;
 
-		if (!info->normal_indices_idx) {
-			nx = ny = nz = 0;
-		} else {
-			uint32_t normal_index = info->normal_indices[i];
+	return eb->img->chain.level[0].h - ea->img->chain.level[0].h;
+}
 
-			nx = info->normals[normal_index * 3];
-			ny = info->normals[normal_index * 3 + 1];
-			nz = info->normals[normal_index * 3 + 2];
-		}
+static inline float *vertex_uv(struct wfobj *shape, uint32_t i)
+{
+	return (float *) ((uint8_t *) shape->array + i * shape->layout.stride +
+	  shape->layout.uv.offset);
+}
 
-		shape->array[shape->array_size++] = nx;
-		shape->array[shape->array_size++] = ny;
-		shape->array[shape->array_size++] = nz;
+/* atlas cannot repeat texture, so uv must stay within [0, 1] */
 
-		float tx;
-		float ty;
+static uint8_t uv_clamped(struct wfobj *shape)
+{
+	const struct wfobj_layout *layout = &shape->layout;
+	float min[2] = { FLT_MAX, FLT_MAX };
+	float max[2] = { -FLT_MAX, -FLT_MAX };
 
-		if (!info->uv_indices_idx) {
-			tx = ty = 0;
-		} else {
-			uint32_t uv_index = info->uv_indices[i];
+	if (!layout->uv.size) {
+		return 0;
+	} else if (layout->packed) {
+		for (uint8_t c = 0; c < 2; ++c) {
+			min[c] = layout->uv_bias[c];
+			max[c] = layout->uv_bias[c] + layout->uv_scale[c];
+		}
+	} else {
+		for (uint32_t i = 0; i < shape->vertices_num; ++i) {
+			const float *uv = vertex_uv(shape, i);
 
-			tx = info->uvs[uv_index * 2];
-			ty = info->uvs[uv_index * 2 + 1];
+			for (uint8_t c = 0; c < 2; ++c) {
+				min[c] = fminf(min[c], uv[c]);
+				max[c] = fmaxf(max[c], uv[c]);
+			}
 		}
+	}
+
+	return min[0] >= -UV_EPSILON && min[1] >= -UV_EPSILON &&
+	  max[0] <= 1 + UV_EPSILON && max[1] <= 1 + UV_EPSILON;
+}
 
-		shape->array[shape->array_size++] = tx;
-		shape->array[shape->array_size++] = ty;
+/* packed layout is remapped by its dequantization, float one in place */
 
-		if (shape->with_color) {
-			//vertex_index *= 3;;
-			shape->color.r = info->colors[vertex_index * 3];
-			shape->color.g = info->colors[vertex_index * 3 + 1];
-			shape->color.b = info->colors[vertex_index * 3 + 2];
-
-			shape->array[shape->array_size++] = shape->color.r;
-			shape->array[shape->array_size++] = shape->color.g;
-			shape->array[shape->array_size++] = shape->color.b;
-			dd("vertex %u | color (%f %f %f)\n", vertex_index,
-			  shape->color.r, shape->color.g, shape->color.b);
+static uint8_t remap_uv(struct wfobj *shape, struct context *ctx,
+  const float scale[2], const float bias[2])
+{
+	struct wfobj_layout *layout = &shape->layout;
+
+	if (layout->packed) {
+		for (uint8_t c = 0; c < 2; ++c) {
+			layout->uv_bias[c] = layout->uv_bias[c] * scale[c] +
+			  bias[c];
+			layout->uv_scale[c] *= scale[c];
 		}
 
-		dd("[%u] %u | v { %.4f %.4f %.4f } | n { %.4f %.4f %.4f } | t { %.4f %.4f }\n",
-		  i, vertex_index, vx, vy, vz, nx, ny, nz, tx, ty);
+		return 1;
 	}
 
-	list_add(&model->shapes, &shape->head);
+	if (cook_owns(&ctx->cooked, shape->array)) { /* mapping is read-only */
+		void *array = malloc(shape->array_size);
+
+		if (!array) {
+			ee("failed to allocate %u bytes\n", shape->array_size);
+			return 0;
+		}
 
-	info->vertices_idx = 0;
-	info->colors_idx = 0;
-	info->vertex_indices_idx = 0;
+		memcpy(array, shape->array, shape->array_size);
+		shape->array = array;
+	}
 
-	info->normals_idx = 0;
-	info->normal_indices_idx = 0;
+	for (uint32_t i = 0; i < shape->vertices_num; ++i) {
+		float *uv = vertex_uv(shape, i);
 
-	info->uvs_idx = 0;
-	info->uv_indices_idx = 0;
+		uv[0] = uv[0] * scale[0] + bias[0];
+		uv[1] = uv[1] * scale[1] + bias[1];
+	}
 
 	return 1;
 }
 
-static void prepare_texlib(char *buf, size_t len, struct texlib *texlib)
+/* compose packed textures into one image and point shapes at it */
+
+static void make_atlas(struct model *model, struct loader *ld,
+  struct atlas *atlas, uint8_t idx, struct atlas_entry *entries,
+  uint16_t num)
 {
+	struct context *ctx = (struct context *) model->ctx;
+	struct texture_image *res;
 	struct list_head *cur;
-	char *mtl = NULL;
-	char *ptr = buf;
-	char *end = buf + len;
-	char *str = NULL;
-	uint16_t texnum = 0;
+	uint16_t h = ATLAS_ALIGN;
+	uint8_t planes = 3;
+	uint8_t *pixels;
+	char name[64];
+
+	while (h < atlas->used_h)
+		h <<= 1;
+
+	for (uint16_t i = 0; i < num; ++i) {
+		if (!entries[i].skip && entries[i].atlas == idx &&
+		  entries[i].img->chain.planes == 4)
+			planes = 4;
+	}
 
-	while (*ptr != '\0' && ptr < end) {
-		if (!str)
-			str = ptr;
+	snprintf(name, sizeof(name), "@atlas/%p/%u", (void *) ctx, idx);
 
-		if (*ptr++ != '\n') /* BEWARE of '\r' endings! */
-			continue;
+	if (!(pixels = calloc((size_t) atlas->w * h, planes)) ||
+	  !(res = calloc(1, sizeof(*res))) || !(res->name = strdup(name))) {
+		ee("failed to allocate atlas %ux%u\n", atlas->w, h);
+		free(pixels);
+		return;
+	}
 
-		*(ptr - 1) = '\0';
+	for (uint16_t i = 0; i < num; ++i) {
+		const struct mip_chain *chain = &entries[i].img->chain;
 
-		dd("str: '%s'\n", str);
+		if (!entries[i].skip && entries[i].atlas == idx)
+			atlas_blit(pixels, atlas->w, planes, chain->data,
+			  chain->level[0].w, chain->level[0].h, chain->planes,
+			  entries[i].x, entries[i].y, ATLAS_PADDING);
+	}
 
-		if (str[0] == 'n' && str[1] == 'e' && str[2] == 'w' &&
-		  str[3] == 'm' && str[4] == 't' && str[5] == 'l' &&
-		  str[6] == ' ') {
-			strip_str(str);
+	uint8_t ret = mip_build(pixels, atlas->w, h, planes, ATLAS_LEVELS,
+	  &res->chain);
 
-			uint8_t found = 0;
+	free(pixels);
 
-			list_walk(cur, &texlib->items) {
-				struct texlib_item *item = texlib_item(cur);
+	if (!ret) {
+		free(res->name);
+		free(res);
+		return;
+	}
 
-				if (strcmp(&str[7], item->material) == 0) {
-					found = 1;
-					break;
-				}
-			}
+	atomic_init(&res->ready, 1);
+	list_add(&ld->images, &res->head);
 
-			if (!found)
-				mtl = strdup(&str[7]);
-		} else if (str[0] == 'm' && str[1] == 'a' && str[2] == 'p' &&
-				str[3] == '_' && str[4] == 'K' && str[5] == 'd' &&
-				str[6] == ' ') {
-			if (!mtl)
-				continue;
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct atlas_entry *entry = find_entry(entries, num,
+		  shape->texname);
+		char *texname;
 
-			strip_str(str);
-			struct texlib_item *item = calloc(1, sizeof(*item));
+		if (!entry || entry->skip || entry->atlas != idx)
+			continue;
 
-			if (!item) {
-				free(mtl);
-			} else {
-				item->material = mtl;
-				item->texname = strdup(&str[7]);
-				list_add(&texlib->items, &item->head);
-				texnum++;
-			}
+		const struct mip_level *level = &entry->img->chain.level[0];
+		float scale[2] = { level->w / (float) atlas->w,
+		  level->h / (float) h };
+		float bias[2] = { (entry->x + ATLAS_PADDING) / (float) atlas->w,
+		  (entry->y + ATLAS_PADDING) / (float) h };
 
-			mtl = NULL;
+		if (!(texname = strdup(name)) ||
+		  !remap_uv(shape, ctx, scale, bias)) {
+			free(texname);
+			continue; /* keeps its own texture */
 		}
 
-		str = NULL;
+		free(shape->texname);
+		shape->texname = texname;
 	}
 
-	ii("found %u textures\n", texnum);
-
-	list_walk(cur, &texlib->items) {
-		struct texlib_item *item = texlib_item(cur);
-
-		ii("material %s | texture %s\n", item->material, item->texname);
-	}
+	ii("atlas %s %ux%u planes %u\n", name, atlas->w, h, planes);
 }
 
-static void prepare_mtllib(const char *path, struct texlib *texlib)
+/* pack decoded textures of model into few atlases; shapes with wrapped
+ * uv keep their textures and so do compressed ones */
+
+static void build_atlases(struct model *model, struct loader *ld)
 {
-	struct asset_info ainfo;
+	struct atlas atlases[MAX_ATLASES];
+	uint16_t members[MAX_ATLASES] = {0};
+	struct atlas_entry *entries;
+	struct list_head *cur;
+	uint16_t limit = model->atlas / 2;
+	uint8_t atlases_num = 0;
+	uint16_t packed = 0;
+	uint16_t num = 0;
 
-	ii("prepare materials library %s\n", path);
+	if (!model->atlas || model->lazy_textures || !ld->images.next)
+		return;
 
-	if (!get_asset(path, &ainfo, texlib->ctx->amgr))
+	if (!pot(model->atlas)) {
+		ww("atlas size %u is not power of two\n", model->atlas);
 		return;
+	}
 
-	prepare_texlib((char *) ainfo.buf, ainfo.len, texlib);
-	put_asset(&ainfo);
-}
+	list_walk(cur, &ld->images)
+		num++;
 
-static inline char *parse_indices(char *token, uint16_t *vi, uint16_t *ti,
-  uint16_t *ni)
-{
-	dd("token %#x | str: %s\n", *token & 0xff, token);
+	if (num < 2 || !(entries = calloc(num, sizeof(*entries))))
+		return;
 
-	if (!token || *token == '\0')
-		return NULL;
+	num = 0;
 
-	char *ptr = token;
-	char *end = ptr + strlen(token);
+	list_walk(cur, &ld->images) {
+		struct texture_image *img = teximage_item(cur);
+		const struct mip_chain *chain = &img->chain;
 
-	*vi = *ti = *ni = 1;
+		if (image_ready(img) && chain->data &&
+		  chain->format == MIP_RAW &&
+		  chain->level[0].w + 2 * ATLAS_PADDING <= limit &&
+		  chain->level[0].h + 2 * ATLAS_PADDING <= limit)
+			entries[num++].img = img;
+	}
 
-	while (ptr < end) {
-		if ((*vi = atoi(ptr)))
-			*vi -= 1;
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct atlas_entry *entry = find_entry(entries, num,
+		  shape->texname);
 
-		if (!(ptr = strchr(ptr, '/')))
-			break; /* only vertex indices */
+		if (entry && !uv_clamped(shape))
+			entry->skip = 1;
+	}
 
-		ptr++;
+	qsort(entries, num, sizeof(*entries), cmp_entries);
 
-		if (*ptr == '/') {
-			ptr++; /* no uv indices */
-		} else {
-			if ((*ti = atoi(ptr)))
-				*ti -= 1;
+	for (uint16_t i = 0; i < num; ++i) {
+		struct atlas_entry *entry = &entries[i];
+		uint16_t w = entry->img->chain.level[0].w + 2 * ATLAS_PADDING;
+		uint16_t h = entry->img->chain.level[0].h + 2 * ATLAS_PADDING;
+		uint8_t a = 0;
 
-			if (!(ptr = strchr(ptr, '/'))) {
-				ptr = end;
-				break; /* no normal indices */
-			}
+		if (entry->skip)
+			continue;
 
-			ptr++;
-		}
+		while (a < atlases_num && !atlas_pack(&atlases[a], w, h,
+		  &entry->x, &entry->y))
+			a++;
 
-		if (ptr < end)
-			if ((*ni = atoi(ptr)))
-				*ni -= 1;
+		if (a == atlases_num) {
+			if (a == MAX_ATLASES ||
+			  !atlas_init(&atlases[a], model->atlas, model->atlas)) {
+				entry->skip = 1;
+				continue;
+			}
 
-		ptr += strlen(ptr);
+			atlases_num++;
+			atlas_pack(&atlases[a], w, h, &entry->x, &entry->y);
+		}
 
-		if (*vi && *ti && *ni)
-			break;
+		entry->atlas = a;
+		members[a]++;
 	}
 
-	ptr++; /* skip '\0' */
+	for (uint16_t i = 0; i < num; ++i) {
+		if (members[entries[i].atlas] < 2) /* nothing to share */
+			entries[i].skip = 1;
+	}
 
-	dd("--> %u %u %u | ptr: %s\n", *vi, *ti, *ni, ptr);
-	return ptr;
-}
+	for (uint8_t a = 0; a < atlases_num; ++a) {
+		if (members[a] >= 2)
+			make_atlas(model, ld, &atlases[a], a, entries, num);
 
-static void prepare_indices(char *str, struct shape_info *info)
-{
-	char *ptr = str;
-	char *end = ptr + strlen(ptr);
+		atlas_release(&atlases[a]);
+	}
 
-	uint16_t vi[4];
-	uint16_t ti[4];
-	uint16_t ni[4];
+	/* drop packed images unless some shape still refers to them */
 
-	dd("prepare indices from str: %s\n", ptr);
+	for (uint16_t i = 0; i < num; ++i) {
+		struct texture_image *img = entries[i].img;
+		uint8_t used = 0;
 
-	/* split string */
+		if (entries[i].skip)
+			continue;
 
-	uint8_t multi = 0;
-	uint8_t verts_num = 1;
+		list_walk(cur, &model->shapes) {
+			struct wfobj *shape = container_of(cur, struct wfobj,
+			  head);
 
-	while (ptr++ < end) {
-		if (*ptr == ' ') {
-			*ptr = '\0';
-			verts_num++;
-		} else if (*ptr == '/') {
-			multi = 1;
+			if (shape->texname && strcmp(shape->texname,
+			  img->name) == 0)
+				used = 1;
 		}
+
+		if (used)
+			continue;
+
+		list_del(&img->head);
+		mip_free(&img->chain);
+		free(img->name);
+		free(img);
+		packed++;
 	}
 
-	dd("multi %u | %u vertices | str: '%s'\n", multi, verts_num, str);
-	ptr = str;
+	free(entries);
 
-	uint8_t n = 0;
+	if (packed)
+		ii("packed %u textures into %u atlases\n", packed, atlases_num);
+}
 
-	while (ptr && ptr < end) {
-		if (multi) {
-			ptr = parse_indices(ptr, &vi[n], &ti[n], &ni[n]);
-			dd("%u | vi %u ti %u ni %u\n", n, vi[n], ti[n], ni[n]);
-		} else { /* vertex indices only */
-			info->vertex_indices[info->vertex_indices_idx++] = atoi(ptr);
-			ptr += strlen(ptr) + 1;
-			dd("vertex_indices[%u] %u | next str '%s'\n",
-			  info->vertex_indices_idx - 1,
-			  info->vertex_indices[i], ptr);
-			continue;
-		}
+static void free_shape_data_arrays(struct context *ctx, struct wfobj *shape)
+{
+	if (!cook_owns(&ctx->cooked, shape->array))
+		free(shape->array);
 
-		n++;
+	if (!cook_owns(&ctx->cooked, shape->indices))
+		free(shape->indices);
+
+	shape->array = NULL;
+	shape->indices = NULL;
+}
 
-		if (verts_num == 3 && n == 3) {
-			n = 0;
-			info->vertex_indices[info->vertex_indices_idx++] = vi[0];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[1];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[2];
+static struct wfobj *make_submesh(struct wfobj *shape,
+  const uint32_t *indices, uint32_t indices_num, const uint32_t *order,
+  uint32_t vertices_num, const uint32_t *remap)
+{
+	struct wfobj *sub = calloc(1, sizeof(*sub));
+	uint32_t stride = shape->layout.stride;
 
-			info->normal_indices[info->normal_indices_idx++] = ni[0];
-			info->normal_indices[info->normal_indices_idx++] = ni[1];
-			info->normal_indices[info->normal_indices_idx++] = ni[2];
+	if (!sub) {
+		ee("failed to allocate submesh\n");
+		return NULL;
+	}
 
-			if (info->uv_indices) {
-				info->uv_indices[info->uv_indices_idx++] = ti[0];
-				info->uv_indices[info->uv_indices_idx++] = ti[1];
-				info->uv_indices[info->uv_indices_idx++] = ti[2];
-			}
-		} else if (verts_num == 4 && n == 4) { /* then triangulate */
-			n = 0;
-			info->vertex_indices[info->vertex_indices_idx++] = vi[0];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[1];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[2];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[0];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[2];
-			info->vertex_indices[info->vertex_indices_idx++] = vi[3];
-
-			info->normal_indices[info->normal_indices_idx++] = ni[0];
-			info->normal_indices[info->normal_indices_idx++] = ni[1];
-			info->normal_indices[info->normal_indices_idx++] = ni[2];
-			info->normal_indices[info->normal_indices_idx++] = ni[0];
-			info->normal_indices[info->normal_indices_idx++] = ni[2];
-			info->normal_indices[info->normal_indices_idx++] = ni[3];
-
-			if (info->uv_indices) {
-				info->uv_indices[info->uv_indices_idx++] = ti[0];
-				info->uv_indices[info->uv_indices_idx++] = ti[1];
-				info->uv_indices[info->uv_indices_idx++] = ti[2];
-				info->uv_indices[info->uv_indices_idx++] = ti[0];
-				info->uv_indices[info->uv_indices_idx++] = ti[2];
-				info->uv_indices[info->uv_indices_idx++] = ti[3];
-			}
-		} else if (n > 4) {
-			ww("more than 4 vertices per face is not supported\n");
-			n = 0;
-		}
+	sub->array = malloc(vertices_num * stride);
+	sub->indices = malloc(indices_num * sizeof(uint16_t));
+
+	if (!sub->array || !sub->indices) {
+		ee("failed to allocate submesh of %u vertices\n", vertices_num);
+		free(sub->array);
+		free(sub->indices);
+		free(sub);
+		return NULL;
 	}
 
-#if 0
-	printf("%u indices: ", info->vertex_indices_idx);
+	uint8_t *dst = sub->array;
+	const uint8_t *src = shape->array;
+
+	for (uint32_t i = 0; i < vertices_num; ++i)
+		memcpy(dst + i * stride, src + order[i] * stride, stride);
+
+	uint16_t *indices16 = sub->indices;
 
-	for (uint8_t i = 0; i < info->vertex_indices_idx; ++i)
-		printf("%u ", info->vertex_indices[i] - 1);
+	for (uint32_t i = 0; i < indices_num; ++i)
+		indices16[i] = remap[indices[i]];
 
-	printf("\n\n");
-#endif
+	sub->visible = shape->visible;
+	sub->name = strdup(shape->name);
+	sub->texname = shape->texname ? strdup(shape->texname) : NULL;
+	sub->tex = shape->tex;
+	sub->with_color = shape->with_color;
+	sub->color = shape->color;
+	sub->indices_type = GL_UNSIGNED_SHORT;
+	sub->indices_num = indices_num;
+	sub->vertices_num = vertices_num;
+	sub->array_size = vertices_num * stride;
+	sub->layout = shape->layout;
+
+	return sub;
 }
 
-static uint8_t prepare_context(struct model *model)
+/* without 32-bit indices support cut shape into submeshes of no more than
+ * 65535 vertices; submeshes are put right after original shape */
+
+static uint8_t split_shape(struct context *ctx, struct wfobj *shape)
 {
-	if (model->ctx) {
+	const uint32_t *indices = shape->indices;
+	struct list_head *next = shape->head.next;
+	uint32_t *remap = malloc(shape->vertices_num * sizeof(*remap));
+	uint32_t *order = malloc((MAX_INDEX16 + 1) * sizeof(*order));
+	uint32_t used = 0;
+	uint32_t first = 0;
+	uint16_t subs = 0;
+	uint8_t ret = 0;
+
+	if (!remap || !order) {
+		ee("failed to allocate split tables for %u vertices\n",
+		  shape->vertices_num);
+		goto out;
+	}
+
+	memset(remap, 0xff, shape->vertices_num * sizeof(*remap));
+
+	for (uint32_t i = 0; i <= shape->indices_num; i += 3) {
+		uint8_t add = 0;
+
+		if (i < shape->indices_num) {
+			for (uint8_t k = 0; k < 3; ++k)
+				add += remap[indices[i + k]] == UINT32_MAX;
+
+			if (used + add <= MAX_INDEX16) {
+				for (uint8_t k = 0; k < 3; ++k) {
+					uint32_t v = indices[i + k];
+
+					if (remap[v] == UINT32_MAX) {
+						remap[v] = used;
+						order[used++] = v;
+					}
+				}
+
+				continue;
+			}
+		}
+
+		struct wfobj *sub = make_submesh(shape, indices + first,
+		  i - first, order, used, remap);
+
+		if (!sub)
+			goto out;
+
+		list_add(next, &sub->head);
+		subs++;
+
+		for (uint32_t k = 0; k < used; ++k)
+			remap[order[k]] = UINT32_MAX;
+
+		used = 0;
+		first = i;
+
+		if (i < shape->indices_num)
+			i -= 3; /* retry this triangle in next submesh */
+	}
+
+	ii("shape '%s' split %u vertices into %u submeshes\n", shape->name,
+	  shape->vertices_num, subs);
+
+	/* original shape takes first submesh, the rest get new ids */
+
+	struct wfobj *sub = container_of(shape->head.next, struct wfobj, head);
+
+	free_shape_data_arrays(ctx, shape);
+
+	shape->array = sub->array;
+	shape->array_size = sub->array_size;
+	shape->indices = sub->indices;
+	shape->indices_num = sub->indices_num;
+	shape->indices_type = sub->indices_type;
+	shape->vertices_num = sub->vertices_num;
+
+	list_del(&sub->head);
+	free(sub->name);
+	free(sub->texname);
+	free(sub);
+
+	for (struct list_head *cur = shape->head.next; cur != next;
+	  cur = cur->next)
+		container_of(cur, struct wfobj, head)->id = ctx->shapes_num++;
+
+	ret = 1;
+out:
+	while (!ret && shape->head.next != next) { /* drop partial split */
+		struct wfobj *sub = container_of(shape->head.next,
+		  struct wfobj, head);
+
+		list_del(&sub->head);
+		free(sub->array);
+		free(sub->indices);
+		free(sub->name);
+		free(sub->texname);
+		free(sub);
+	}
+
+	free(remap);
+	free(order);
+	return ret;
+}
+
+static inline uint8_t index_size(const struct wfobj *shape)
+{
+	return shape->indices_type == GL_UNSIGNED_INT ? sizeof(uint32_t) :
+	  sizeof(uint16_t);
+}
+
+/* model buffers are bound by caller */
+
+/* returns 1 if shape is bound to placeholder until its texture is decoded */
+
+static inline uint8_t upload_shape(struct wfobj *shape, struct context *ctx)
+{
+	uint8_t pending = 0;
+
+	if (!shape->array_size || !shape->indices_num) {
+		ww("bad array or indices size: %u %u\n", shape->array_size,
+		  shape->indices_num);
+		return 0;
+	}
+
+	glBufferSubData(GL_ARRAY_BUFFER, shape->array_offset,
+	  shape->array_size, shape->array);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, shape->indices_offset,
+	  shape->indices_num * index_size(shape), shape->indices);
+
+	if (!(shape->tex = load_texture(shape->texname, ctx))) {
+		shape->tex = texture_acquire(NULL, ctx->amgr, NULL);
+		ctx->loader->pending++;
+		pending = 1;
+	}
+
+	ii("shape uploaded | vbo %u at %u, %u bytes | ibo %u at %u, %u indices | tex %u | with color %u\n",
+	  shape->vbo, shape->array_offset, shape->array_size, shape->ibo,
+	  shape->indices_offset, shape->indices_num, shape->tex,
+	  shape->with_color);
+
+	return pending;
+}
+
+static void optimize_shape(struct wfobj *shape, uint32_t *indices)
+{
+	uint32_t stride = shape->layout.stride / sizeof(float);
+	float acmr = mesh_acmr(indices, shape->indices_num,
+	  shape->vertices_num, MESH_CACHE_SIZE);
+
+	if (!mesh_optimize_triangles(indices, shape->indices_num, shape->array,
+	  shape->vertices_num, stride, MESH_CACHE_SIZE))
+		return;
+
+	mesh_optimize_vertices(indices, shape->indices_num, shape->array,
+	  shape->vertices_num, stride);
+
+	ii("shape '%s' optimized | acmr %.3f -> %.3f\n", shape->name, acmr,
+	  mesh_acmr(indices, shape->indices_num, shape->vertices_num,
+	  MESH_CACHE_SIZE));
+}
+
+static inline void set_attrib(struct wfobj_attrib *attrib, GLenum type,
+  uint8_t size, uint8_t normalized, uint8_t offset)
+{
+	attrib->type = type;
+	attrib->size = size;
+	attrib->normalized = normalized;
+	attrib->offset = offset;
+}
+
+static void set_float_layout(struct wfobj_layout *layout, uint8_t with_color)
+{
+	memset(layout, 0, sizeof(*layout));
+
+	layout->stride = with_color ? ARRAY_STRIDE_COLOR : ARRAY_STRIDE;
+	set_attrib(&layout->position, GL_FLOAT, 3, 0, 0);
+	set_attrib(&layout->normal, GL_FLOAT, 3, 0, 12);
+	set_attrib(&layout->uv, GL_FLOAT, 2, 0, 24);
+
+	if (with_color)
+		set_attrib(&layout->color, GL_FLOAT, 3, 0, 32);
+}
+
+struct packed_vertex {
+	int16_t position[4]; /* w is padding to keep normal 4-byte aligned */
+	int16_t normal[2];
+	uint16_t uv[2];
+	uint8_t color[4]; /* only with color */
+};
+
+static inline float clampf(float val, float min, float max)
+{
+	return val < min ? min : (val > max ? max : val);
+}
+
+static inline int16_t snorm16(float val)
+{
+	return lrintf(clampf(val, -1, 1) * INT16_MAX);
+}
+
+static inline uint16_t unorm16(float val)
+{
+	return lrintf(clampf(val, 0, 1) * UINT16_MAX);
+}
+
+static inline uint8_t unorm8(float val)
+{
+	return lrintf(clampf(val, 0, 1) * UINT8_MAX);
+}
+
+static inline float signf(float val)
+{
+	return val >= 0 ? 1 : -1;
+}
+
+/* project unit vector onto octahedron and unfold lower half over upper one */
+
+static void oct_encode(const float *n, int16_t *res)
+{
+	float len = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x = 0;
+	float y = 0;
+
+	if (len > 0) {
+		x = n[0] / len;
+		y = n[1] / len;
+
+		if (n[2] < 0) {
+			float tmp = x;
+
+			x = (1 - fabsf(y)) * signf(tmp);
+			y = (1 - fabsf(tmp)) * signf(y);
+		}
+	}
+
+	res[0] = snorm16(x);
+	res[1] = snorm16(y);
+}
+
+static inline float dequant_scale(float min, float max, float range)
+{
+	return max > min ? (max - min) / range : 1;
+}
+
+/* quantize float array of prepared shape into packed layout; positions use
+ * model extents so that all shapes share same dequantization */
+
+static uint8_t pack_shape(struct wfobj *shape, const struct model *model)
+{
+	struct wfobj_layout *layout = &shape->layout;
+	uint32_t fstride = layout->stride / sizeof(float);
+	const float *src = shape->array;
+	float uv_min[2] = { INFINITY, INFINITY };
+	float uv_max[2] = { -INFINITY, -INFINITY };
+	uint8_t stride = shape->with_color ? PACKED_STRIDE_COLOR : PACKED_STRIDE;
+	uint8_t *array = calloc(shape->vertices_num, stride);
+
+	if (!array) {
+		ee("failed to allocate packed array for shape '%s'\n",
+		  shape->name);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < shape->vertices_num; ++i) {
+		const float *uv = src + i * fstride + 6;
+
+		for (uint8_t k = 0; k < 2; ++k) {
+			uv_min[k] = fminf(uv_min[k], uv[k]);
+			uv_max[k] = fmaxf(uv_max[k], uv[k]);
+		}
+	}
+
+	for (uint8_t k = 0; k < 3; ++k) {
+		layout->pos_bias[k] = (model->min.data[k] +
+		  model->max.data[k]) / 2;
+		layout->pos_scale[k] = dequant_scale(model->min.data[k],
+		  model->max.data[k], 2);
+	}
+
+	for (uint8_t k = 0; k < 2 && shape->vertices_num; ++k) {
+		layout->uv_bias[k] = uv_min[k];
+		layout->uv_scale[k] = dequant_scale(uv_min[k], uv_max[k], 1);
+	}
+
+	for (uint32_t i = 0; i < shape->vertices_num; ++i) {
+		const float *in = src + i * fstride;
+		struct packed_vertex *out = (void *) (array + i * stride);
+
+		for (uint8_t k = 0; k < 3; ++k)
+			out->position[k] = snorm16((in[k] -
+			  layout->pos_bias[k]) / layout->pos_scale[k]);
+
+		oct_encode(in + 3, out->normal);
+
+		for (uint8_t k = 0; k < 2; ++k)
+			out->uv[k] = unorm16((in[6 + k] - layout->uv_bias[k]) /
+			  layout->uv_scale[k]);
+
+		if (shape->with_color) {
+			for (uint8_t k = 0; k < 3; ++k)
+				out->color[k] = unorm8(in[8 + k]);
+
+			out->color[3] = UINT8_MAX;
+		}
+	}
+
+	ii("shape '%s' packed %u -> %u bytes\n", shape->name,
+	  shape->array_size, shape->vertices_num * stride);
+
+	free(shape->array);
+	shape->array = array;
+	shape->array_size = shape->vertices_num * stride;
+
+	layout->packed = 1;
+	layout->stride = stride;
+	set_attrib(&layout->position, GL_SHORT, 3, 1, 0);
+	set_attrib(&layout->normal, GL_SHORT, 2, 1, 8);
+	set_attrib(&layout->uv, GL_UNSIGNED_SHORT, 2, 1, 12);
+
+	if (shape->with_color)
+		set_attrib(&layout->color, GL_UNSIGNED_BYTE, 4, 1, 16);
+
+	return 1;
+}
+
+static inline uint32_t corner_hash(uint32_t v, uint32_t t, uint32_t n)
+{
+	return (v * 73856093) ^ (t * 19349663) ^ (n * 83492791);
+}
+
+/* corners sharing vertex, uv and normal indices share one vertex; color is
+ * bound to vertex index and so follows it */
+
+static uint32_t weld_corners(struct shape_info *info, uint32_t num,
+  uint8_t with_normals, uint8_t with_uvs, uint32_t *indices,
+  uint32_t *corners)
+{
+	uint32_t size = 1;
+
+	while (size < num * 2)
+		size <<= 1;
+
+	uint32_t *slots = calloc(size, sizeof(*slots));
+
+	if (!slots) {
+		ee("failed to allocate %u weld slots\n", size);
+		return 0;
+	}
+
+	const uint32_t *vis = info->vertex_indices + info->vertex_indices_start;
+	const uint32_t *nis = info->normal_indices + info->normal_indices_start;
+	const uint32_t *tis = info->uv_indices + info->uv_indices_start;
+	uint32_t mask = size - 1;
+	uint32_t unique = 0;
+
+	for (uint32_t i = 0; i < num; ++i) {
+		uint32_t v = vis[i];
+		uint32_t n = with_normals ? nis[i] : 0;
+		uint32_t t = with_uvs ? tis[i] : 0;
+
+		if (v >= info->vertices_idx / 3 ||
+		  (with_normals && n >= info->normals_idx / 3) ||
+		  (with_uvs && t >= info->uvs_idx / 2)) {
+			ee("face index out of range | v %u n %u t %u\n",
+			  v + 1, n + 1, t + 1);
+			free(slots);
+			return 0;
+		}
+
+		uint32_t slot = corner_hash(v, t, n) & mask;
+
+		while (slots[slot]) {
+			uint32_t c = corners[slots[slot] - 1];
+
+			if (vis[c] == v && (!with_normals || nis[c] == n) &&
+			  (!with_uvs || tis[c] == t))
+				break;
+
+			slot = (slot + 1) & mask;
+		}
+
+		if (!slots[slot]) {
+			corners[unique++] = i;
+			slots[slot] = unique;
+		}
+
+		indices[i] = slots[slot] - 1;
+	}
+
+	free(slots);
+	return unique;
+}
+
+static uint8_t prepare_shape(struct model *model, struct shape_info *info)
+{
+	uint32_t vertex_indices_num;
+	uint32_t normal_indices_num;
+	uint32_t uv_indices_num;
+
+	vertex_indices_num = info->vertex_indices_idx - info->vertex_indices_start;
+	normal_indices_num = info->normal_indices_idx - info->normal_indices_start;
+	uv_indices_num = info->uv_indices_idx - info->uv_indices_start;
+
+	if (normal_indices_num && (normal_indices_num != vertex_indices_num)) {
+		ee("normal and vertex indices mismatch | n %u != v %u\n",
+		  normal_indices_num, vertex_indices_num);
+		return 0;
+	}
+
+	if (uv_indices_num && (uv_indices_num != vertex_indices_num)) {
+		ee("uv and vertex indices mismatch | uv %u != v %u\n",
+		  uv_indices_num, vertex_indices_num);
+		return 0;
+	}
+
+	ii("prepare shape '%s' : vi %u, ni %u, ti %u | v %.1f, n %.1f, uvs %.1f\n",
+	  info->name, vertex_indices_num, normal_indices_num, uv_indices_num,
+	  info->vertices_idx / 3., info->normals_idx / 3., info->uvs_idx / 2.);
+
+	struct wfobj *shape = calloc(1, sizeof(*shape));
+
+	if (!shape) {
+		ee("failed to allocate shape memory\n");
+		return 0;
+	}
+
+	uint32_t *indices;
+	uint32_t size = vertex_indices_num * sizeof(*indices);
+
+	if (!(shape->indices = indices = malloc(size))) {
+		ee("failed to allocate %u bytes for shape '%s'\n",
+		  size, info->name);
+		free(shape);
+		return 0;
+	}
+
+	uint32_t *corners;
+
+	size = vertex_indices_num * sizeof(*corners);
+
+	if (!(corners = malloc(size))) {
+		ee("failed to allocate %u bytes for shape '%s'\n",
+		  size, info->name);
+		dealloc(shape->indices);
+		free(shape);
+		return 0;
+	}
+
+	uint32_t vertices_num = weld_corners(info, vertex_indices_num,
+	  !!normal_indices_num, !!uv_indices_num, indices, corners);
+
+	if (vertex_indices_num && !vertices_num) {
+		free(corners);
+		dealloc(shape->indices);
+		free(shape);
+		return 0;
+	}
+
+	shape->indices_num = vertex_indices_num;
+	shape->vertices_num = vertices_num;
+
+	size = vertices_num * sizeof(*info->vertices) * 3;
+	size += vertices_num * sizeof(*info->normals) * 3;
+	size += vertices_num * sizeof(*info->uvs) * 2;
+
+	if (info->colors_idx)
+		size += vertices_num * sizeof(*info->colors) * 3;
+
+	float *array;
+	uint32_t n = 0;
+
+	if (!(shape->array = array = malloc(size))) {
+		ee("failed to allocate %u bytes for shape '%s'\n",
+		  size, info->name);
+		free(corners);
+		dealloc(shape->indices);
+		free(shape);
+		return 0;
+	}
+
+	struct context *ctx = (struct context *) model->ctx;
+
+	shape->id = ctx->shapes_num++;
+	shape->name = strdup(info->name);
+	shape->visible = 1;
+	shape->with_color = !!info->colors_idx;
+	set_float_layout(&shape->layout, shape->with_color);
+
+	if (info->texname) {
+		shape->texname = strdup(info->texname);
+		info->texname = NULL;
+	}
+
+	ii("shape '%s' id %u | vertices welded %u -> %u\n", shape->name,
+	  shape->id, vertex_indices_num, vertices_num);
+
+	union color_rgb default_color = { .r = 1, .g = 1, .b = 1 };
+
+	if (model->rgb.r >= 0 && model->rgb.g >= 0 && model->rgb.b >= 0)
+		default_color = model->rgb;
+
+	for (uint32_t i = 0; i < vertices_num; ++i) {
+		uint32_t corner = corners[i];
+		uint32_t vi = info->vertex_indices_start + corner;
+		uint32_t vertex_index = info->vertex_indices[vi];
+		float vx = info->vertices[vertex_index * 3];
+		float vy = info->vertices[vertex_index * 3 + 1];
+		float vz = info->vertices[vertex_index * 3 + 2];
+
+		array[n++] = vx;
+		array[n++] = vy;
+		array[n++] = vz;
+
+		if (model->max.x < vx)
+			model->max.x = vx;
+		if (model->max.y < vy)
+			model->max.y = vy;
+		if (model->max.z < vz)
+			model->max.z = vz;
+
+		if (model->min.x > vx)
+			model->min.x = vx;
+		if (model->min.y > vy)
+			model->min.y = vy;
+		if (model->min.z > vz)
+			model->min.z = vz;
+
+		float nx;
+		float ny;
+		float nz;
+
+		if (!normal_indices_num) {
+			nx = ny = nz = 0;
+		} else {
+			uint32_t ni = info->normal_indices_start + corner;
+			uint32_t normal_index = info->normal_indices[ni];
+
+			nx = info->normals[normal_index * 3];
+			ny = info->normals[normal_index * 3 + 1];
+			nz = info->normals[normal_index * 3 + 2];
+		}
+
+		array[n++] = nx;
+		array[n++] = ny;
+		array[n++] = nz;
+
+		float tx;
+		float ty;
+
+		if (!uv_indices_num) {
+			tx = ty = 0;
+		} else {
+			uint32_t ti = info->uv_indices_start + corner;
+			uint32_t uv_index = info->uv_indices[ti];
+
+			tx = info->uvs[uv_index * 2];
+			ty = info->uvs[uv_index * 2 + 1];
+		}
+
+		array[n++] = tx;
+		array[n++] = ty;
+
+		if (shape->with_color) {
+			if (vertex_index * 3 < info->colors_idx) {
+				shape->color.r = info->colors[vertex_index * 3];
+				shape->color.g = info->colors[vertex_index * 3 + 1];
+				shape->color.b = info->colors[vertex_index * 3 + 2];
+			} else { /* vertex came without color */
+				shape->color = default_color;
+			}
+
+			array[n++] = shape->color.r;
+			array[n++] = shape->color.g;
+			array[n++] = shape->color.b;
+			dd("vertex %u | color (%f %f %f)\n", vertex_index,
+			  shape->color.r, shape->color.g, shape->color.b);
+		}
+
+		dd("[%u] %u | v { %.4f %.4f %.4f } | n { %.4f %.4f %.4f } | t { %.4f %.4f }\n",
+		  i, vertex_index, vx, vy, vz, nx, ny, nz, tx, ty);
+	}
+
+	free(corners);
+	shape->array_size = n * sizeof(float);
+
+	if (model->optimize)
+		optimize_shape(shape, indices);
+
+	if (vertices_num <= MAX_INDEX16) { /* pack indices in place */
+		uint16_t *indices16 = shape->indices;
+
+		for (uint32_t i = 0; i < vertex_indices_num; ++i)
+			indices16[i] = indices[i];
+
+		shape->indices_type = GL_UNSIGNED_SHORT;
+	} else {
+		shape->indices_type = GL_UNSIGNED_INT;
+	}
+
+	list_add(&model->shapes, &shape->head);
+
+	/* vertices, normals and uvs are global in wavefront files; only
+	 * indices belong to the shape */
+
+	info->vertex_indices_start = info->vertex_indices_idx;
+	info->normal_indices_start = info->normal_indices_idx;
+	info->uv_indices_start = info->uv_indices_idx;
+
+	return 1;
+}
+
+static uint8_t grow_component(void **ptr, uint32_t *max, uint32_t need,
+  size_t size)
+{
+	uint64_t num = *max ? *max : 1024;
+
+	while (num < need)
+		num *= 2;
+
+	if (num * size > SIZE_MAX || num > UINT32_MAX) {
+		ee("component size is out of range %u\n", need);
+		return 0;
+	}
+
+	void *tmp = realloc(*ptr, num * size);
+
+	if (!tmp) {
+		ee("failed to allocate %zu bytes\n", (size_t) (num * size));
+		return 0;
+	}
+
+	*ptr = tmp;
+	*max = num;
+
+	return 1;
+}
+
+#define reserve_component(info, component, num)\
+	((info)->component##_idx + (num) <= (info)->component##_max ||\
+	 grow_component((void **) &(info)->component, &(info)->component##_max,\
+	  (info)->component##_idx + (num), sizeof(*(info)->component)))
+
+#define alloc_component(info, component, num)\
+	grow_component((void **) &(info)->component, &(info)->component##_max,\
+	  num, sizeof(*(info)->component))
+
+static inline const char *trim_end(const char *str, const char *end)
+{
+	while (end > str && (end[-1] == '\r' || end[-1] == ' ' ||
+	  end[-1] == '\t'))
+		end--;
+
+	return end;
+}
+
+#define match_cmd(str, end, cmd) ((end) - (str) >= (long) sizeof(cmd) - 1 &&\
+	memcmp(str, cmd, sizeof(cmd) - 1) == 0)
+
+static void prepare_texlib(const char *buf, size_t len, struct texlib *texlib)
+{
+	struct list_head *cur;
+	char *mtl = NULL;
+	const char *ptr = buf;
+	const char *end = buf + len;
+	uint16_t texnum = 0;
+
+	while (ptr < end && *ptr != '\0') {
+		const char *str = ptr;
+		const char *eol = tok_eol(ptr, end);
+
+		ptr = eol + 1;
+		eol = trim_end(str, eol);
+
+		dd("str: '%.*s'\n", (int) (eol - str), str);
+
+		if (match_cmd(str, eol, "newmtl ")) {
+			uint8_t found = 0;
+			size_t len = eol - str - 7;
+
+			list_walk(cur, &texlib->items) {
+				struct texlib_item *item = texlib_item(cur);
+
+				if (strlen(item->material) == len &&
+				  memcmp(&str[7], item->material, len) == 0) {
+					found = 1;
+					break;
+				}
+			}
+
+			free(mtl);
+			mtl = found ? NULL : strndup(&str[7], len);
+		} else if (match_cmd(str, eol, "map_Kd ")) {
+			if (!mtl)
+				continue;
+
+			struct texlib_item *item = calloc(1, sizeof(*item));
+
+			if (!item) {
+				free(mtl);
+			} else {
+				item->material = mtl;
+				item->texname = strndup(&str[7], eol - str - 7);
+				list_add(&texlib->items, &item->head);
+				texnum++;
+			}
+
+			mtl = NULL;
+		}
+	}
+
+	free(mtl);
+
+	ii("found %u textures\n", texnum);
+
+	list_walk(cur, &texlib->items) {
+		struct texlib_item *item = texlib_item(cur);
+
+		ii("material %s | texture %s\n", item->material, item->texname);
+	}
+}
+
+static void prepare_mtllib(const char *path, struct texlib *texlib)
+{
+	struct asset_info ainfo;
+
+	ii("prepare materials library %s\n", path);
+
+	if (!get_asset(path, &ainfo, texlib->ctx->amgr))
+		return;
+
+	prepare_texlib((const char *) ainfo.buf, ainfo.len, texlib);
+	put_asset(&ainfo);
+}
+
+#define MAX_FACE_VERTICES 4
+
+static const uint8_t face_order_[] = { 0, 1, 2, 0, 2, 3 };
+
+static inline uint32_t face_index(int32_t val)
+{
+	return val > 0 ? val - 1 : 0; /* wavefront indices start from 1 */
+}
+
+static uint8_t prepare_indices(const char *ptr, const char *end,
+  struct shape_info *info)
+{
+	uint32_t vi[MAX_FACE_VERTICES];
+	uint32_t ti[MAX_FACE_VERTICES];
+	uint32_t ni[MAX_FACE_VERTICES];
+	uint8_t with_uv = 1;
+	uint8_t with_normal = 1;
+	uint8_t n = 0;
+	int32_t val;
+
+	dd("prepare indices from str: %.*s\n", (int) (end - ptr), ptr);
+
+	while ((ptr = tok_skip(ptr, end)) < end) {
+		if (n == MAX_FACE_VERTICES) {
+			ww("more than 4 vertices per face is not supported\n");
+			return 1;
+		} else if (!(ptr = tok_int(ptr, end, &val))) {
+			ww("bad face vertex index\n");
+			return 1;
+		}
+
+		vi[n] = face_index(val);
+		ti[n] = ni[n] = 0;
+
+		uint8_t uv = 0;
+		uint8_t normal = 0;
+
+		if (ptr < end && *ptr == '/') {
+			if (++ptr < end && *ptr != '/') {
+				if (!(ptr = tok_int(ptr, end, &val))) {
+					ww("bad face uv index\n");
+					return 1;
+				}
+
+				ti[n] = face_index(val);
+				uv = 1;
+			}
+
+			if (ptr < end && *ptr == '/') {
+				if (!(ptr = tok_int(ptr + 1, end, &val))) {
+					ww("bad face normal index\n");
+					return 1;
+				}
+
+				ni[n] = face_index(val);
+				normal = 1;
+			}
+		}
+
+		with_uv &= uv;
+		with_normal &= normal;
+		n++;
+	}
+
+	if (n < 3)
+		return 1;
+
+	uint8_t num = n == 3 ? 3 : 6; /* triangulate quads */
+
+	with_uv &= !!info->uv_indices;
+
+	if (!reserve_component(info, vertex_indices, num))
+		return 0;
+	else if (with_normal && !reserve_component(info, normal_indices, num))
+		return 0;
+	else if (with_uv && !reserve_component(info, uv_indices, num))
+		return 0;
+
+	for (uint8_t i = 0; i < num; ++i) {
+		uint8_t k = face_order_[i];
+
+		info->vertex_indices[info->vertex_indices_idx++] = vi[k];
+
+		if (with_normal)
+			info->normal_indices[info->normal_indices_idx++] = ni[k];
+
+		if (with_uv)
+			info->uv_indices[info->uv_indices_idx++] = ti[k];
+	}
+
+	return 1;
+}
+
+static uint8_t prepare_context(struct model *model)
+{
+	if (model->ctx) {
 		return 1;
 	} else if (!(model->ctx = calloc(1, sizeof(struct context)))) {
 		ee("failed to create model context\n");
@@ -622,252 +1597,751 @@ static inline void free_shape_data(struct shape_info *info)
 	dealloc(info->uv_indices);
 }
 
-#define alloc_component(component) malloc(sizeof(*(component)) * MAX_INDEX)
+static inline uint8_t alloc_shape_data(struct shape_info *info, size_t len,
+  uint8_t ignore_texture)
+{
+	uint32_t num = len / LINE_LEN_HINT;
+
+	memset(info, 0, sizeof(*info));
+
+	/* colors are rare; let them grow on demand */
+
+	if (!alloc_component(info, vertices, num))
+		goto err;
+
+	if (!alloc_component(info, vertex_indices, num))
+		goto err;
+
+	if (!alloc_component(info, normals, num))
+		goto err;
+
+	if (!alloc_component(info, normal_indices, num))
+		goto err;
+
+	if (!ignore_texture) {
+		if (!alloc_component(info, uvs, num))
+			goto err;
+
+		if (!alloc_component(info, uv_indices, num))
+			goto err;
+	}
+
+	return 1;
+
+err:
+	free_shape_data(info);
+	return 0;
+}
+
+static uint8_t prepare_vertices(const char *ptr, const char *end,
+  struct shape_info *info)
+{
+	const char *cur = ptr;
+	float val[6];
+	uint8_t n = 0;
+
+	while (n < 6 && (cur = tok_float(cur, end, &val[n])))
+		n++;
+
+	if (n < 3) {
+		ee("'v float float float' is expected | str: '%.*s'\n",
+		  (int) (end - ptr), ptr);
+		return 0;
+	} else if (!reserve_component(info, vertices, 3)) {
+		return 0;
+	} else if (n == 6 && !reserve_component(info, colors, 3)) {
+		return 0;
+	}
+
+	info->vertices[info->vertices_idx++] = val[0];
+	info->vertices[info->vertices_idx++] = val[1];
+	info->vertices[info->vertices_idx++] = val[2];
+
+	if (n == 6) { /* color information is attached */
+		info->colors[info->colors_idx++] = val[3];
+		info->colors[info->colors_idx++] = val[4];
+		info->colors[info->colors_idx++] = val[5];
+	}
+
+	return 1;
+}
+
+static uint8_t prepare_normals(const char *ptr, const char *end,
+  struct shape_info *info)
+{
+	union gm_point3 normal;
+
+	if (!(ptr = tok_float(ptr, end, &normal.x)) ||
+	  !(ptr = tok_float(ptr, end, &normal.y)) ||
+	  !(ptr = tok_float(ptr, end, &normal.z))) {
+		ee("'vn float float float' is expected\n");
+		return 0;
+	} else if (!reserve_component(info, normals, 3)) {
+		return 0;
+	}
+
+	info->normals[info->normals_idx++] = normal.x;
+	info->normals[info->normals_idx++] = normal.y;
+	info->normals[info->normals_idx++] = normal.z;
+
+	return 1;
+}
+
+static uint8_t prepare_uv(const char *ptr, const char *end,
+  struct shape_info *info)
+{
+	union gm_point2 uv;
+
+	if (!(ptr = tok_float(ptr, end, &uv.x)) ||
+	  !(ptr = tok_float(ptr, end, &uv.y))) {
+		ee("'vt float float' is expected\n");
+		return 0;
+	} else if (!reserve_component(info, uvs, 2)) {
+		return 0;
+	}
+
+	info->uvs[info->uvs_idx++] = uv.x;
+	info->uvs[info->uvs_idx++] = uv.y;
+
+	return 1;
+}
+
+static uint8_t add_mark(struct chunk *chunk, uint8_t type, const char *str,
+  const char *end)
+{
+	if (chunk->marks_num == chunk->marks_max) {
+		uint32_t max = chunk->marks_max ? chunk->marks_max * 2 : 64;
+		struct mark *marks = realloc(chunk->marks, max * sizeof(*marks));
+
+		if (!marks) {
+			ee("failed to allocate %u marks\n", max);
+			return 0;
+		}
+
+		chunk->marks = marks;
+		chunk->marks_max = max;
+	}
+
+	struct mark *mark = &chunk->marks[chunk->marks_num++];
+
+	mark->type = type;
+	mark->str = str;
+	mark->len = end - str;
+	mark->vertex_indices_idx = chunk->info.vertex_indices_idx;
+	mark->normal_indices_idx = chunk->info.normal_indices_idx;
+	mark->uv_indices_idx = chunk->info.uv_indices_idx;
+
+	return 1;
+}
+
+static void *parse_chunk(void *arg)
+{
+	struct chunk *chunk = (struct chunk *) arg;
+	struct model *model = chunk->model;
+	struct shape_info *info = &chunk->info;
+	const char *ptr = chunk->buf;
+	const char *end = chunk->end;
+
+	chunk->ret = 0;
+
+	while (ptr < end && *ptr != '\0') {
+		const char *str = ptr;
+		const char *eol = tok_eol(ptr, end);
+
+		ptr = eol + 1;
+		eol = trim_end(str, eol);
+
+		dd("str: '%.*s'\n", (int) (eol - str), str);
+
+		if (eol - str < 2) {
+			continue;
+		} else if ((str[0] == 'o' || str[0] == 'g') && str[1] == ' ') {
+			if (!add_mark(chunk, MARK_NAME, &str[2], eol))
+				return NULL;
+		} else if (model->rgb.r < 0 && match_cmd(str, eol, "mtllib ")) {
+			if (!add_mark(chunk, MARK_MTLLIB, &str[7], eol))
+				return NULL;
+		} else if (model->rgb.r < 0 && match_cmd(str, eol, "usemtl ")) {
+			if (!add_mark(chunk, MARK_USEMTL, &str[7], eol))
+				return NULL;
+		} else if (str[0] == 'f' && str[1] == ' ') {
+			if (!prepare_indices(str + 2, eol, info)) /* f[[:space:]] */
+				return NULL;
+		} else if (str[0] == 'v' && str[1] == ' ') {
+			if (!prepare_vertices(str + 2, eol, info))
+				return NULL;
+		} else if (str[0] == 'v' && str[1] == 'n') {
+			if (!prepare_normals(str + 2, eol, info))
+				return NULL;
+		} else if (!model->ignore_texture &&
+		  str[0] == 'v' && str[1] == 't') { /* texture uv */
+			if (!prepare_uv(str + 2, eol, info))
+				return NULL;
+		}
+	}
+
+	chunk->ret = 1;
+	return NULL;
+}
+
+#define merge_component(info, chunks, num, component) {\
+	uint32_t total__ = 0;\
+	for (uint8_t i__ = 0; i__ < (num); ++i__)\
+		total__ += (chunks)[i__].info.component##_idx;\
+	if (!alloc_component(info, component, total__ + 1))\
+		goto err;\
+	for (uint8_t i__ = 0; i__ < (num); ++i__) {\
+		struct shape_info *src__ = &(chunks)[i__].info;\
+		if (src__->component##_idx)\
+			memcpy((info)->component + (info)->component##_idx,\
+			  src__->component, sizeof(*(info)->component) *\
+			  src__->component##_idx);\
+		(info)->component##_idx += src__->component##_idx;\
+		dealloc(src__->component); /* counts are kept for marks */\
+		src__->component##_max = 0;\
+	}\
+}
+
+static uint8_t merge_chunks(struct chunk *chunks, uint8_t num,
+  struct shape_info *info)
+{
+	merge_component(info, chunks, num, vertices);
+	merge_component(info, chunks, num, colors);
+	merge_component(info, chunks, num, vertex_indices);
+	merge_component(info, chunks, num, normals);
+	merge_component(info, chunks, num, normal_indices);
+
+	if (chunks[0].info.uvs) {
+		merge_component(info, chunks, num, uvs);
+		merge_component(info, chunks, num, uv_indices);
+	}
+
+	/* face indices are global in file, only shift marks to merged arrays */
+
+	uint32_t vertex_indices_base = 0;
+	uint32_t normal_indices_base = 0;
+	uint32_t uv_indices_base = 0;
+
+	for (uint8_t i = 0; i < num; ++i) {
+		struct chunk *chunk = &chunks[i];
+
+		for (uint32_t m = 0; m < chunk->marks_num; ++m) {
+			struct mark *mark = &chunk->marks[m];
+
+			mark->vertex_indices_idx += vertex_indices_base;
+			mark->normal_indices_idx += normal_indices_base;
+			mark->uv_indices_idx += uv_indices_base;
+		}
+
+		vertex_indices_base += chunk->info.vertex_indices_idx;
+		normal_indices_base += chunk->info.normal_indices_idx;
+		uv_indices_base += chunk->info.uv_indices_idx;
+	}
+
+	return 1;
+
+err:
+	free_shape_data(info);
+	return 0;
+}
+
+static uint8_t split_chunks(const char *buf, size_t len, struct model *model,
+  struct chunk *chunks, uint8_t num)
+{
+	const char *end = buf + len;
+	const char *ptr = buf;
+
+	for (uint8_t i = 0; i < num; ++i) {
+		struct chunk *chunk = &chunks[i];
+
+		chunk->model = model;
+		chunk->buf = ptr;
+
+		if (i == num - 1) {
+			ptr = end;
+		} else {
+			ptr = buf + len / num * (i + 1);
+
+			if (ptr < chunk->buf)
+				ptr = chunk->buf;
+
+			while (ptr < end && *ptr != '\n')
+				ptr++;
+
+			if (ptr < end)
+				ptr++; /* chunk ends right after new line */
+		}
+
+		chunk->end = ptr;
+
+		if (!alloc_shape_data(&chunk->info, chunk->end - chunk->buf,
+		  model->ignore_texture)) {
+			ee("failed to map shape info data\n");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t parse_chunks(struct chunk *chunks, uint8_t num)
+{
+	uint8_t ret = 1;
+	uint8_t started = 1;
+
+	for (uint8_t i = 1; i < num; ++i, ++started) {
+		if (pthread_create(&chunks[i].thread, NULL, parse_chunk,
+		  &chunks[i]) != 0) {
+			ee("failed to start parser thread %u\n", i);
+			break;
+		}
+	}
+
+	parse_chunk(&chunks[0]); /* calling thread takes first chunk */
+
+	for (uint8_t i = 1; i < started; ++i)
+		pthread_join(chunks[i].thread, NULL);
+
+	for (uint8_t i = started; i < num; ++i)
+		parse_chunk(&chunks[i]);
+
+	for (uint8_t i = 0; i < num; ++i)
+		ret &= chunks[i].ret;
+
+	return ret;
+}
+
+static void use_material(const struct mark *mark, struct shape_info *info,
+  struct texlib *texlib)
+{
+	struct list_head *cur;
+
+	ii("use mtl: %.*s\n", (int) mark->len, mark->str);
+
+	list_walk(cur, &texlib->items) {
+		struct texlib_item *item = texlib_item(cur);
+
+		if (strlen(item->material) == mark->len &&
+		  memcmp(mark->str, item->material, mark->len) == 0) {
+			info->texname = item->texname;
+			break;
+		}
+	}
+}
+
+/* replay marks in file order until next shape is prepared; last shape is
+ * prepared once all marks are consumed */
 
-static inline uint8_t alloc_shape_data(struct shape_info *info,
-  uint8_t ignore_texture)
+static uint8_t replay_marks(struct model *model, struct loader *ld)
 {
-	info->vertices_idx = 0;
-	info->colors_idx = 0;
-	info->vertex_indices_idx = 0;
-
-	info->normals_idx = 0;
-	info->normal_indices_idx = 0;
+	struct shape_info *info = &ld->info;
 
-	info->uvs_idx = 0;
-	info->uv_indices_idx = 0;
+	for (; ld->chunk < ld->chunks_num; ld->chunk++, ld->mark = 0) {
+		struct chunk *chunk = &ld->chunks[ld->chunk];
 
-	if (!(info->vertices = alloc_component(info->vertices)))
-		goto err;
+		while (ld->mark < chunk->marks_num) {
+			struct mark *mark = &chunk->marks[ld->mark++];
 
-	if (!(info->colors = alloc_component(info->colors)))
-		goto err;
+			if (mark->type == MARK_MTLLIB) {
+				char *path = strndup(mark->str, mark->len);
 
-	if (!(info->vertex_indices = alloc_component(info->vertex_indices)))
-		goto err;
+				if (path)
+					prepare_mtllib(path, &ld->texlib);
 
-	if (!(info->normals = alloc_component(info->normals)))
-		goto err;
+				free(path);
+			} else if (mark->type == MARK_USEMTL) {
+				use_material(mark, info, &ld->texlib);
+			} else if (mark->type == MARK_NAME) {
+				uint8_t ready = mark->vertex_indices_idx >
+				  info->vertex_indices_start;
 
-	if (!(info->normal_indices = alloc_component(info->normal_indices)))
-		goto err;
+				info->vertex_indices_idx = mark->vertex_indices_idx;
+				info->normal_indices_idx = mark->normal_indices_idx;
+				info->uv_indices_idx = mark->uv_indices_idx;
 
+				if (ready)
+					prepare_shape(model, info);
 
-	if (ignore_texture) {
-		info->uvs = NULL;
-		info->uv_indices = NULL;
-	} else {
-		if (!(info->uvs = alloc_component(info->uvs)))
-			goto err;
+				free((void *) info->name);
+				info->name = strndup(mark->str, mark->len);
 
-		if (!(info->uv_indices = alloc_component(info->uv_indices)))
-			goto err;
+				if (ready)
+					return 1;
+			}
+		}
 	}
 
-	return 1;
+	info->vertex_indices_idx = ld->indices_end[0];
+	info->normal_indices_idx = ld->indices_end[1];
+	info->uv_indices_idx = ld->indices_end[2];
 
-err:
-	free_shape_data(info);
-	return 0;
+	if (!info->name)
+		info->name = strdup(model->name);
+
+	ld->stage = LOAD_PACK;
+	ld->shape = model->shapes.next;
+
+	return prepare_shape(model, info);
 }
 
-static uint8_t prepare_vertices(char *str, struct shape_info *info)
+static uint8_t init_loader(struct model *model, struct loader *ld,
+  const char *buf, size_t len)
 {
-	union gm_point3 vertex;
-	union color_rgb color;
-	uint8_t n;
+	uint8_t num = model->threads ? model->threads : 1;
 
-	/* check if color information is attached */
-	n = sscanf(str, "v %f %f %f %f %f %f\n",
-	  &vertex.x, &vertex.y, &vertex.z, &color.r, &color.g, &color.b);
+	if (ld->incremental) { /* chunk is the parser step */
+		size_t steps = len / MIN_CHUNK_LEN;
 
-	if (n == 6) {
-		info->vertices[info->vertices_idx++] = vertex.x;
+		if (steps > num)
+			num = steps < UINT8_MAX ? steps : UINT8_MAX;
+	} else if (len / num < MIN_CHUNK_LEN)
+		num = len / MIN_CHUNK_LEN ? len / MIN_CHUNK_LEN : 1;
 
-		if (info->vertices_idx >= MAX_INDEX) {
-			ee("num of vertices is out of range %u\n", MAX_INDEX);
-			return 0;
-		}
+	num = num ? num : 1;
 
-		info->vertices[info->vertices_idx++] = vertex.y;
+	if (!(ld->chunks = calloc(num, sizeof(*ld->chunks)))) {
+		ee("failed to allocate %u chunks\n", num);
+		return 0;
+	}
 
-		if (info->vertices_idx >= MAX_INDEX) {
-			ee("num of vertices is out of range %u\n", MAX_INDEX);
-			return 0;
-		}
+	ld->chunks_num = num;
+	ld->chunk = 0;
+	ld->stage = LOAD_PARSE;
+	ld->start_time = time_ms();
 
-		info->vertices[info->vertices_idx++] = vertex.z;
+	list_init(&ld->texlib.items);
+	ld->texlib.ctx = (struct context *) model->ctx;
+	memset(&ld->info, 0, sizeof(ld->info));
 
-		if (info->vertices_idx >= MAX_INDEX) {
-			ee("num of vertices is out of range %u\n", MAX_INDEX);
-			return 0;
-		}
+	ii("loading model from buf %p len %zu | %u chunks\n", buf, len, num);
 
-		info->colors[info->colors_idx++] = color.r;
-		info->colors[info->colors_idx++] = color.g;
-		info->colors[info->colors_idx++] = color.b;
-		return 1;
+	return split_chunks(buf, len, model, ld->chunks, num);
+}
+
+/* parser state is only needed until shapes are prepared */
+
+static void release_parser(struct loader *ld)
+{
+	struct list_head *cur;
+	struct list_head *tmp;
+
+	free((void *) ld->info.name);
+	free_shape_data(&ld->info);
+	memset(&ld->info, 0, sizeof(ld->info));
+
+	for (uint8_t i = 0; i < ld->chunks_num; ++i) {
+		free_shape_data(&ld->chunks[i].info);
+		free(ld->chunks[i].marks);
 	}
 
-	n = sscanf(str, "v %f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
+	dealloc(ld->chunks);
+	ld->chunks_num = 0;
 
-	if (n != 3) {
-		ee("'v float float float' is expected | str: '%s'\n", str);
-		return 0;
+	if (ld->texlib.items.next) {
+		list_walk_safe(cur, tmp, &ld->texlib.items) {
+			struct texlib_item *item = texlib_item(cur);
+
+			list_del(&item->head);
+
+			free(item->material);
+			free(item->texname);
+			free(item);
+		}
 	}
 
-	info->vertices[info->vertices_idx++] = vertex.x;
-	info->vertices[info->vertices_idx++] = vertex.y;
-	info->vertices[info->vertices_idx++] = vertex.z;
+	if (ld->ainfo.buf)
+		put_asset(&ld->ainfo);
 
-	return 1;
+	memset(&ld->ainfo, 0, sizeof(ld->ainfo));
 }
 
-static uint8_t prepare_normals(char *str, struct shape_info *info)
+static void release_images(struct loader *ld)
 {
-	union gm_point3 normal;
-	uint8_t n;
+	struct list_head *cur;
+	struct list_head *tmp;
+
+	if (!ld->images.next)
+		return;
 
-	n = sscanf(str, "vn %f %f %f\n", &normal.x, &normal.y, &normal.z);
+	list_walk_safe(cur, tmp, &ld->images) {
+		struct texture_image *img = teximage_item(cur);
 
-	if (n != 3) {
-		ee("'vn float float float' is expected | str: '%s'\n", str);
-		return 0;
+		list_del(&img->head);
+
+		mip_free(&img->chain);
+
+		free(img->name);
+		free(img);
 	}
+}
 
-	info->normals[info->normals_idx++] = normal.x;
-	info->normals[info->normals_idx++] = normal.y;
-	info->normals[info->normals_idx++] = normal.z;
+static void release_loader(struct context *ctx)
+{
+	if (!ctx->loader)
+		return;
 
-	return 1;
+	join_pool(ctx->loader, 1);
+	release_parser(ctx->loader);
+	release_images(ctx->loader);
+	dealloc(ctx->loader);
 }
 
-static uint8_t prepare_uv(char *str, struct shape_info *info)
+static uint8_t merge_step(struct model *model, struct loader *ld)
 {
-	union gm_point2 uv;
-	uint8_t n = sscanf(str, "vt %f %f\n", &uv.x, &uv.y);
+	struct shape_info *info = &ld->info;
 
-	if (n != 2) {
-		ee("'vt float float' is expected | str: '%s'\n", str);
+	if (ld->chunks_num == 1) {
+		*info = ld->chunks[0].info;
+		memset(&ld->chunks[0].info, 0, sizeof(ld->chunks[0].info));
+	} else if (!merge_chunks(ld->chunks, ld->chunks_num, info)) {
 		return 0;
 	}
 
-	info->uvs[info->uvs_idx++] = uv.x;
-	info->uvs[info->uvs_idx++] = uv.y;
+	ii("parsed %u chunks in %u ms\n", ld->chunks_num,
+	  (uint32_t) time_ms() - ld->start_time);
+
+	info->ctx = (struct context *) model->ctx;
+	ld->indices_end[0] = info->vertex_indices_idx;
+	ld->indices_end[1] = info->normal_indices_idx;
+	ld->indices_end[2] = info->uv_indices_idx;
+	ld->chunk = 0;
+	ld->mark = 0;
+	ld->stage = LOAD_SHAPES;
 
 	return 1;
 }
 
-uint8_t load_model(char *buf, size_t len, struct model *model)
+static void finish_prepare(struct model *model, struct loader *ld)
+{
+	struct context *ctx = (struct context *) model->ctx;
+
+	ii("prepared %u shapes in %u ms\n", ctx->shapes_num,
+	  (uint32_t) time_ms() - ld->start_time);
+
+	ii("model extents min { %.4f %.4f %.4f } max { %.4f %.4f %.4f }\n",
+	  model->min.x, model->min.y, model->min.z,
+	  model->max.x, model->max.y, model->max.z);
+
+	if (model->cache_dir && ld->cooked[0])
+		cook_save(ld->cooked, ld->key, model);
+
+	release_parser(ld);
+	ld->stage = LOAD_TEXTURES;
+	ld->shape = model->shapes.next;
+}
+
+static void layout_step(struct model *model, struct loader *ld)
 {
+	struct context *ctx = (struct context *) model->ctx;
 	struct list_head *cur;
-	struct texlib texlib;
-	struct shape_info info;
-	uint8_t ret = 0;
-	char *ptr = buf;
-	char *end = buf + len;
-	char *str = NULL;
-	uint32_t start_time = time_ms();
+	uint8_t index32 = gl_extension("GL_OES_element_index_uint");
 
-	list_init(&texlib.items);
+	ld->start_time = time_ms();
+	ld->array_bytes = 0;
+	ld->indices_bytes = 0;
+	ld->decode_ms = 0;
+	ld->decode_speedup = 1;
 
-	if (!alloc_shape_data(&info, model->ignore_texture)) {
-		ee("failed to map shape info data\n");
-		return 0;
+	if (!ld->incremental) { /* incremental loads decode while preparing */
+		decode_textures(model, ld, !model->lazy_textures);
+		build_atlases(model, ld);
 	}
 
-	ii("loading model from buf %p len %zu\n", buf, len);
+	/* lay out all shapes in one vertex and one index buffer; index
+	 * offsets are kept 4-byte aligned for mixed index types */
 
-	info.ctx = (struct context *) model->ctx;
-	info.name = NULL;
-	info.texname = NULL;
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
 
-	while (*ptr != '\0' && ptr < end) {
-		if (!str)
-			str = ptr;
+		if (shape->indices_type == GL_UNSIGNED_INT && !index32 &&
+		  !split_shape(ctx, shape)) {
+			ee("failed to split shape '%s', it is hidden\n",
+			  shape->name);
+			free_shape_data_arrays(ctx, shape);
+			shape->visible = 0;
+			shape->array_size = 0;
+			shape->indices_num = 0;
+		}
 
-		if (*ptr++ != '\n') /* BEWARE of '\r' endings! */
-			continue;
+		ld->indices_bytes = (ld->indices_bytes + 3) & ~3;
+		shape->array_offset = ld->array_bytes;
+		shape->indices_offset = ld->indices_bytes;
+		ld->array_bytes += shape->array_size;
+		ld->indices_bytes += shape->indices_num * index_size(shape);
+	}
 
-		*(ptr - 1) = '\0';
+	glGenBuffers(1, &model->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
+	glBufferData(GL_ARRAY_BUFFER, ld->array_bytes, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		dd("str: '%s'\n", str);
+	glGenBuffers(1, &model->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, ld->indices_bytes, NULL,
+	  GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-		if ((str[0] == 'o' || str[0] == 'g') && str[1] == ' ') {
-			dd("o or g: %s\n", str);
+	ld->shape = model->shapes.next;
+	ld->stage = LOAD_UPLOAD;
+}
 
-			if (info.vertex_indices_idx)
-				prepare_shape(model, &info);
+static inline uint8_t shape_pending(struct loader *ld, struct wfobj *shape)
+{
+	struct texture_image *img;
 
-			strip_str(str);
-			info.name = strdup(&str[2]);
-		} else if (model->rgb.r < 0 &&
-		  str[0] == 'm' && str[1] == 't' && str[2] == 'l' &&
-		  str[3] == 'l' && str[4] == 'i' && str[5] == 'b' &&
-		  str[6] == ' ') {
-			strip_str(str);
-			prepare_mtllib(&str[7], &texlib);
-		} else if (model->rgb.r < 0 &&
-		  str[0] == 'u' && str[1] == 's' && str[2] == 'e' &&
-		  str[3] == 'm' && str[4] == 't' && str[5] == 'l' &&
-		  str[6] == ' ') {
-			strip_str(str);
+	return shape->texname && (img = find_image(ld, shape->texname)) &&
+	  !image_ready(img);
+}
 
-			ii("use mtl: %s\n", str);
+static void upload_step(struct model *model, struct loader *ld)
+{
+	struct context *ctx = (struct context *) model->ctx;
 
-			list_walk(cur, &texlib.items) {
-				struct texlib_item *item = texlib_item(cur);
+	if (ld->shape == &model->shapes) {
+		struct texture_stats stats;
 
-				if (strcmp(&str[7], item->material) == 0) {
-					info.texname = item->texname;
-					break;
-				}
-			}
-		} else if (str[0] == 'f' && str[1] == ' ') {
-			prepare_indices(str + 2, &info); /* f[[:space:]] */
-		} else if (str[0] == 'v' && str[1] == ' ') {
-			if (!prepare_vertices(str, &info))
-				goto out;
-		} else if (str[0] == 'v' && str[1] == 'n') {
-			if (!prepare_normals(str, &info))
-				goto out;
-		} else if (!model->ignore_texture &&
-		  str[0] == 'v' && str[1] == 't') { /* texture uv */
-			if (!prepare_uv(str, &info))
-				goto out;
+		cook_unmap(&ctx->cooked);
+		texture_stats(&stats);
+
+		ii("uploaded %u shapes in %u ms | vbo %u, %u bytes | ibo %u, %u bytes | textures decoded in %u ms, %.1fx\n",
+		  ctx->shapes_num, (uint32_t) time_ms() - ld->start_time,
+		  model->vbo, ld->array_bytes, model->ibo, ld->indices_bytes,
+		  ld->decode_ms, ld->decode_speedup);
+		ii("textures | %u live, %llu bytes | %u hits, %u misses\n",
+		  stats.textures, (unsigned long long) stats.bytes, stats.hits,
+		  stats.misses);
+
+		ld->stage = LOAD_DONE;
+		return;
+	}
+
+	struct wfobj *shape = container_of(ld->shape, struct wfobj, head);
+
+	ld->shape = ld->shape->next;
+	shape->vbo = model->vbo;
+	shape->ibo = model->ibo;
+	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
+
+	uint8_t pending = upload_shape(shape, ctx);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	ii("upload obj %u %s | %u bytes, %u indices | tex %u %s | visible %u\n",
+	  shape->id, shape->name, shape->array_size, shape->indices_num,
+	  shape->tex, shape->texname, shape->visible);
+
+	dealloc(shape->name);
+	free_shape_data_arrays(ctx, shape);
+
+	if (!pending) /* name is needed to swap texture */
+		dealloc(shape->texname);
+}
+
+/* run one unit of work: parser chunk, merge, shape, pack or upload of one
+ * shape; upload stages need gl context */
+
+static uint8_t load_step(struct model *model, struct loader *ld)
+{
+	switch (ld->stage) {
+	case LOAD_PARSE:
+		if (!ld->incremental) {
+			if (!parse_chunks(ld->chunks, ld->chunks_num))
+				return 0;
+
+			ld->chunk = ld->chunks_num;
+		} else if (ld->chunk < ld->chunks_num) {
+			parse_chunk(&ld->chunks[ld->chunk]);
+
+			if (!ld->chunks[ld->chunk++].ret)
+				return 0;
+		}
+
+		if (ld->chunk == ld->chunks_num)
+			ld->stage = LOAD_MERGE;
+
+		return 1;
+	case LOAD_MERGE:
+		return merge_step(model, ld);
+	case LOAD_SHAPES:
+		return replay_marks(model, ld);
+	case LOAD_PACK:
+		if (model->pack && ld->shape != &model->shapes) {
+			struct wfobj *shape = container_of(ld->shape,
+			  struct wfobj, head);
+
+			ld->shape = ld->shape->next;
+			pack_shape(shape, model); /* float layout on failure */
+		} else {
+			finish_prepare(model, ld);
 		}
 
-		str = NULL;
+		return 1;
+	case LOAD_TEXTURES: /* only incremental loads decode ahead */
+		if (ld->incremental && ld->shape != &model->shapes) {
+			struct wfobj *shape = container_of(ld->shape,
+			  struct wfobj, head);
+
+			ld->shape = ld->shape->next;
+			decode_texture(ld, shape->texname,
+			  ((struct context *) model->ctx)->amgr);
+		} else {
+			if (ld->incremental)
+				build_atlases(model, ld);
+
+			ld->stage = LOAD_PREPARED;
+		}
+
+		return 1;
+	case LOAD_PREPARED:
+		layout_step(model, ld);
+		return 1;
+	case LOAD_UPLOAD:
+		upload_step(model, ld);
+		return 1;
+	default:
+		return 1;
 	}
+}
 
-	if (!info.name)
-		info.name = strdup(model->name);
+static uint8_t alloc_loader(struct context *ctx)
+{
+	if (ctx->loader)
+		return 1;
+	else if (!(ctx->loader = calloc(1, sizeof(*ctx->loader)))) {
+		ee("failed to allocate model loader\n");
+		return 0;
+	}
 
-	ret = prepare_shape(model, &info);
+	list_init(&ctx->loader->images);
+	return 1;
+}
 
-	ii("prepared %u shapes in %u ms\n", info.ctx->shapes_num,
-	  (uint32_t) time_ms() - start_time);
+uint8_t load_model(const char *buf, size_t len, struct model *model)
+{
+	struct context *ctx = (struct context *) model->ctx;
 
-	ii("model extents min { %.4f %.4f %.4f } max { %.4f %.4f %.4f }\n",
-	  model->min.x, model->min.y, model->min.z,
-	  model->max.x, model->max.y, model->max.z);
-out:
-	free((void *) info.name);
-	free_shape_data(&info);
+	if (!alloc_loader(ctx))
+		return 0;
 
-	struct list_head *tmp;
+	struct loader *ld = ctx->loader;
 
-	list_walk_safe(cur, tmp, &texlib.items) {
-		struct texlib_item *item = texlib_item(cur);
+	ld->cooked[0] = '\0'; /* no cache key for raw buffers */
 
-		list_del(&item->head);
+	if (!init_loader(model, ld, buf, len)) {
+		release_parser(ld);
+		return 0;
+	}
 
-		free(item->material);
-		free(item->texname);
-		free(item);
+	while (ld->stage < LOAD_PREPARED) {
+		if (!load_step(model, ld)) {
+			release_parser(ld);
+			return 0;
+		}
 	}
 
-	return ret;
+	return 1;
 }
 
 void erase_model(struct model *model)
@@ -875,24 +2349,106 @@ void erase_model(struct model *model)
 	struct list_head *cur;
 	struct list_head *tmp;
 
+	glDeleteBuffers(1, &model->vbo);
+	glDeleteBuffers(1, &model->ibo);
+	model->vbo = model->ibo = 0;
+
 	list_walk_safe(cur, tmp, &model->shapes) {
 		struct wfobj *shape = container_of(cur, struct wfobj, head);
 
-		glDeleteBuffers(1, &shape->vbo);
-		glDeleteBuffers(1, &shape->ibo);
-		glDeleteTextures(1, &shape->tex);
+		texture_release(shape->tex);
 
 		list_del(&shape->head);
 
+		if (model->ctx)
+			free_shape_data_arrays(model->ctx, shape);
+
 		free(shape->name);
 		free(shape->texname);
 		free(shape);
 	}
 
+	if (model->ctx) {
+		release_loader(model->ctx);
+		cook_unmap(&((struct context *) model->ctx)->cooked);
+	}
+
 	dealloc(model->ctx);
 }
 
-uint8_t prepare_model(char *path, struct model *model, void *amgr)
+/* cooked texture names come from material libraries, so edited .mtl must
+ * change key as well */
+
+static uint64_t mtllib_key(const char *buf, size_t len, void *amgr,
+  uint64_t key)
+{
+	const char *end = buf + len;
+	const char *ptr = buf;
+
+	while (ptr < end) {
+		const char *str = ptr;
+		const char *eol = tok_eol(ptr, end);
+		struct asset_info ainfo;
+
+		ptr = eol + 1;
+		eol = trim_end(str, eol);
+
+		if (!match_cmd(str, eol, "mtllib "))
+			continue;
+
+		char *path = strndup(&str[7], eol - &str[7]);
+
+		if (path && get_asset(path, &ainfo, amgr)) {
+			key = cook_hash(ainfo.buf, ainfo.len, key);
+			put_asset(&ainfo);
+		} else if (path) {
+			key = cook_hash(path, strlen(path), key); /* missing */
+		}
+
+		free(path);
+	}
+
+	return key;
+}
+
+static uint64_t model_key(const struct model *model, const void *buf,
+  size_t len, void *amgr)
+{
+	uint8_t use_mtl = model->rgb.r < 0; /* then color is not used */
+	float opts[] = {
+		model->ignore_texture,
+		use_mtl ? -1 : model->rgb.r,
+		use_mtl ? 0 : model->rgb.g,
+		use_mtl ? 0 : model->rgb.b,
+		model->optimize,
+		model->pack,
+	};
+	uint64_t key = cook_hash(buf, len, cook_hash(opts, sizeof(opts), 0));
+
+	return use_mtl ? mtllib_key(buf, len, amgr, key) : key;
+}
+
+static uint8_t load_cooked(const char *path, uint64_t key,
+  struct model *model)
+{
+	struct context *ctx = (struct context *) model->ctx;
+	uint32_t start_time = time_ms();
+	uint16_t num;
+
+	if (!(num = cook_load(path, key, model, &ctx->cooked)))
+		return 0;
+
+	ctx->shapes_num = num;
+
+	ii("prepared %u cooked shapes in %u ms\n", num,
+	  (uint32_t) time_ms() - start_time);
+
+	return 1;
+}
+
+
+static uint8_t begin_model(char *path, struct model *model, void *amgr,
+  uint8_t incremental)
 {
 	ii("read file %s\n", path);
 
@@ -901,16 +2457,27 @@ uint8_t prepare_model(char *path, struct model *model, void *amgr)
 		return 0;
 	}
 
+	struct context *ctx = (struct context *) model->ctx;
+
 	model->min.x = model->min.y = model->min.z = UINT32_MAX;
 	model->max.x = model->max.y = model->max.z = 0;
+	model->vbo = model->ibo = 0;
 
 	list_init(&model->shapes);
 
-	((struct context *) model->ctx)->amgr = amgr;
+	ctx->amgr = amgr;
 
-	struct asset_info ainfo;
+	if (!alloc_loader(ctx)) {
+		dealloc(model->ctx);
+		return 0;
+	}
+
+	struct loader *ld = ctx->loader;
 
-	if (!get_asset(path, &ainfo, amgr)) {
+	ld->incremental = incremental;
+
+	if (!get_asset(path, &ld->ainfo, amgr)) {
+		release_loader(ctx);
 		dealloc(model->ctx);
 		return 0;
 	}
@@ -918,59 +2485,144 @@ uint8_t prepare_model(char *path, struct model *model, void *amgr)
 	/* basename can modify path; hence call it here */
 	model->name = basename(path);
 
-	uint8_t ret = load_model((char *) ainfo.buf, ainfo.len, model);
+	if (model->cache_dir) {
+		ld->key = model_key(model, ld->ainfo.buf, ld->ainfo.len,
+		  amgr);
+		snprintf(ld->cooked, sizeof(ld->cooked), "%s/%016llx.rgum",
+		  model->cache_dir, (unsigned long long) ld->key);
+
+		if (load_cooked(ld->cooked, ld->key, model)) {
+			release_parser(ld);
+			ld->stage = LOAD_TEXTURES;
+			ld->shape = model->shapes.next;
+			return 1;
+		}
+	}
 
-	if (!ret)
+	if (!init_loader(model, ld, (const char *) ld->ainfo.buf, ld->ainfo.len)) {
 		erase_model(model);
+		return 0;
+	}
 
-	put_asset(&ainfo);
+	return 1;
+}
 
-	return ret;
+uint8_t prepare_model(char *path, struct model *model, void *amgr)
+{
+	if (!begin_model(path, model, amgr, 0))
+		return 0;
+
+	struct loader *ld = ((struct context *) model->ctx)->loader;
+
+	while (ld->stage < LOAD_PREPARED) {
+		if (!load_step(model, ld)) {
+			erase_model(model);
+			return 0;
+		}
+	}
+
+	return 1;
 }
 
 void upload_model(struct model *model)
 {
-	struct list_head *cur;
-	struct texture_cache cache;
-	uint32_t start_time = time_ms();
-	uint32_t array_bytes = 0;
-	uint32_t indices_bytes = 0;
+	struct loader *ld = ((struct context *) model->ctx)->loader;
+
+	while (ld->stage < LOAD_DONE)
+		load_step(model, ld);
+}
 
-	list_init(&cache.textures);
+uint8_t model_load_begin(char *path, struct model *model, void *amgr)
+{
+	return begin_model(path, model, amgr, 1);
+}
 
-	cache.ctx = (struct context *) model->ctx;
-	cache.deftex = default_texture();
+static uint8_t run_steps(struct model *model, uint32_t budget_us,
+  uint8_t until)
+{
+	struct loader *ld = ((struct context *) model->ctx)->loader;
+	uint64_t start = time_us();
 
-	list_walk(cur, &model->shapes) {
-		struct wfobj *shape = container_of(cur, struct wfobj, head);
+	do {
+		if (!load_step(model, ld)) {
+			ee("failed to load model %s\n", model->name);
+			erase_model(model);
+			return 0;
+		}
+	} while (ld->stage < until && time_us() - start < budget_us);
+
+	return 1;
+}
+
+uint8_t model_load_step(struct model *model, uint32_t budget_us)
+{
+	return run_steps(model, budget_us, LOAD_DONE);
+}
 
-		shape->tex = cache.deftex;
-		upload_shape(shape, &cache);
+uint8_t model_prepare_step(struct model *model, uint32_t budget_us)
+{
+	return run_steps(model, budget_us, LOAD_PREPARED);
+}
 
-		ii("upload obj %u %s | %u elements, %u indices | tex %u %s | visible %u\n",
-		  shape->id, shape->name, shape->array_size, shape->indices_num,
-		  shape->tex, shape->texname, shape->visible);
+uint8_t model_load_progress(const struct model *model)
+{
+	const struct loader *ld;
 
-		array_bytes += shape->array_size;
-		indices_bytes += shape->indices_num;
+	if (!model->ctx || !(ld = ((struct context *) model->ctx)->loader))
+		return 0;
 
-		dealloc(shape->name);
-		dealloc(shape->texname);
-		dealloc(shape->indices);
-		dealloc(shape->array);
+	switch (ld->stage) {
+	case LOAD_PARSE:
+		return 60 * ld->chunk / ld->chunks_num;
+	case LOAD_MERGE:
+		return 60;
+	case LOAD_SHAPES:
+		return 60 + 25 * ld->chunk / ld->chunks_num;
+	case LOAD_PACK:
+		return 85;
+	case LOAD_TEXTURES:
+		return 90;
+	default:
+		return 100;
 	}
+}
 
-	struct list_head *tmp;
+uint8_t model_load_done(const struct model *model)
+{
+	return model->ctx &&
+	  ((struct context *) model->ctx)->loader->stage == LOAD_DONE;
+}
+
+uint16_t model_update_textures(struct model *model)
+{
+	struct context *ctx = (struct context *) model->ctx;
+	struct loader *ld = ctx ? ctx->loader : NULL;
+	struct list_head *cur;
+	uint16_t num = 0;
+
+	if (!ld || !ld->pending || ld->stage != LOAD_DONE)
+		return 0;
 
-	list_walk_safe(cur, tmp, &cache.textures) {
-		struct texture_info *texinfo = texcache_item(cur);
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+
+		if (!shape->texname || shape_pending(ld, shape))
+			continue;
 
-		list_del(&texinfo->head);
-		free(texinfo);
+		GLuint tex = load_texture(shape->texname, ctx);
+
+		ii("shape %u texture %u -> %u %s\n", shape->id, shape->tex, tex,
+		  shape->texname);
+
+		texture_release(shape->tex);
+		shape->tex = tex;
+		dealloc(shape->texname);
+		ld->pending--;
+		num++;
 	}
 
-	ii("uploaded %u shapes in %u ms | total bytes: array %u indices %u\n",
-	  cache.ctx->shapes_num, (uint32_t) time_ms() - start_time,
-	  (uint32_t) (array_bytes * sizeof(float)),
-	  (uint32_t) (indices_bytes * sizeof(uint16_t)));
+	if (!ld->pending)
+		join_pool(ld, 0);
+
+	return num;
 }
@@ -0,0 +1,366 @@
+/* zip.c: assets inside zip and apk archives
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#define TAG "zip"
+
+#include <rgu/log.h>
+#include <rgu/pack.h>
+#include <rgu/pool.h>
+#include <rgu/zip.h>
+
+#define EOCD_SIG 0x06054b50
+#define EOCD_LEN 22
+#define CDIR_SIG 0x02014b50
+#define CDIR_LEN 46
+#define LOCAL_SIG 0x04034b50
+#define LOCAL_LEN 30
+
+#define METHOD_STORED 0
+#define METHOD_DEFLATED 8
+#define FLAG_ENCRYPTED 0x1
+
+struct zip_entry {
+	uint64_t hash; /* pack_hash() of name */
+	const char *name; /* not terminated, points into mapping */
+	uint16_t name_len;
+	uint16_t method;
+	uint32_t offset; /* of local header */
+	uint32_t comp_len;
+	uint32_t len;
+	uint32_t crc;
+};
+
+struct zip {
+	const uint8_t *buf;
+	size_t len;
+	struct zip_entry *entries;
+	uint32_t entries_num;
+};
+
+static struct {
+	struct zip zips[ZIP_MAX];
+	uint8_t zips_num;
+} mounted;
+
+static inline uint16_t rd16(const uint8_t *ptr)
+{
+	return ptr[0] | ptr[1] << 8;
+}
+
+static inline uint32_t rd32(const uint8_t *ptr)
+{
+	return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+/* end of central directory is followed by comment of up to 64k */
+
+static const uint8_t *find_eocd(const uint8_t *buf, size_t len)
+{
+	if (len < EOCD_LEN)
+		return NULL;
+
+	size_t pos = len - EOCD_LEN;
+	size_t end = pos > UINT16_MAX ? pos - UINT16_MAX : 0;
+
+	for (;; --pos) {
+		if (rd32(buf + pos) == EOCD_SIG &&
+		  pos + EOCD_LEN + rd16(buf + pos + 20) <= len)
+			return buf + pos;
+		else if (pos == end)
+			return NULL;
+	}
+}
+
+static int cmp_entries(const void *a, const void *b)
+{
+	uint64_t ha = ((const struct zip_entry *) a)->hash;
+	uint64_t hb = ((const struct zip_entry *) b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+static uint8_t read_cdir(const char *path, struct zip *zip)
+{
+	const uint8_t *eocd = find_eocd(zip->buf, zip->len);
+
+	if (!eocd) {
+		ee("%s is not zip archive\n", path);
+		return 0;
+	}
+
+	uint16_t num = rd16(eocd + 10);
+	uint32_t size = rd32(eocd + 12);
+	uint32_t offset = rd32(eocd + 16);
+
+	if (num == UINT16_MAX || offset == UINT32_MAX) {
+		ee("%s: zip64 archives are not supported\n", path);
+		return 0;
+	} else if (rd16(eocd + 4) != 0 || (size_t) offset + size > zip->len) {
+		ee("%s: bad central directory\n", path);
+		return 0;
+	} else if (!(zip->entries = calloc(num ? num : 1,
+	  sizeof(*zip->entries)))) {
+		ee("failed to allocate %u zip entries\n", num);
+		return 0;
+	}
+
+	const uint8_t *ptr = zip->buf + offset;
+	const uint8_t *end = ptr + size;
+	char name[PATH_MAX];
+
+	for (uint16_t i = 0; i < num; ++i) {
+		if (ptr + CDIR_LEN > end || rd32(ptr) != CDIR_SIG) {
+			ee("%s: bad central directory entry %u\n", path, i);
+			return 0;
+		}
+
+		uint16_t name_len = rd16(ptr + 28);
+		const uint8_t *next = ptr + CDIR_LEN + name_len +
+		  rd16(ptr + 30) + rd16(ptr + 32);
+
+		if (next > end) {
+			ee("%s: bad central directory entry %u\n", path, i);
+			return 0;
+		}
+
+		const char *str = (const char *) ptr + CDIR_LEN;
+
+		if ((rd16(ptr + 8) & FLAG_ENCRYPTED) || !name_len ||
+		  str[name_len - 1] == '/' || name_len >= sizeof(name)) {
+			ptr = next; /* directory or entry we cannot read */
+			continue;
+		}
+
+		struct zip_entry *entry = &zip->entries[zip->entries_num++];
+
+		memcpy(name, str, name_len);
+		name[name_len] = '\0';
+
+		entry->hash = pack_hash(name);
+		entry->name = str;
+		entry->name_len = name_len;
+		entry->method = rd16(ptr + 10);
+		entry->crc = rd32(ptr + 16);
+		entry->comp_len = rd32(ptr + 20);
+		entry->len = rd32(ptr + 24);
+		entry->offset = rd32(ptr + 42);
+		ptr = next;
+	}
+
+	qsort(zip->entries, zip->entries_num, sizeof(*zip->entries),
+	  cmp_entries);
+
+	return 1;
+}
+
+uint8_t zip_mount(const char *path)
+{
+	struct zip zip = {0};
+	struct stat st;
+	void *buf;
+	int fd;
+
+	if (mounted.zips_num == ZIP_MAX) {
+		ee("failed to mount %s, %u archives are mounted\n", path,
+		  ZIP_MAX);
+		return 0;
+	} else if ((fd = open(path, O_RDONLY)) < 0) {
+		ee("failed to open archive %s\n", path);
+		return 0;
+	} else if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		ee("failed to get size of archive %s\n", path);
+		close(fd);
+		return 0;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); /* mapping keeps file */
+
+	if (buf == MAP_FAILED) {
+		ee("failed to map archive %s\n", path);
+		return 0;
+	}
+
+	zip.buf = buf;
+	zip.len = st.st_size;
+
+	if (!read_cdir(path, &zip)) {
+		free(zip.entries);
+		munmap(buf, zip.len);
+		return 0;
+	}
+
+	mounted.zips[mounted.zips_num++] = zip;
+	ii("mounted %s with %u entries\n", path, zip.entries_num);
+
+	return 1;
+}
+
+void zip_unmount(void)
+{
+	for (uint8_t i = 0; i < mounted.zips_num; ++i) {
+		struct zip *zip = &mounted.zips[i];
+
+		free(zip->entries);
+		munmap((void *) zip->buf, zip->len);
+	}
+
+	mounted.zips_num = 0;
+}
+
+/* archive names may come as ./x or a//b, compare them normalized as they
+ * were hashed */
+
+static uint8_t same_name(const struct zip_entry *entry, const char *name)
+{
+	char raw[PATH_MAX];
+	char buf[PATH_MAX];
+
+	if (entry->name_len == strlen(name) &&
+	  memcmp(entry->name, name, entry->name_len) == 0)
+		return 1;
+
+	memcpy(raw, entry->name, entry->name_len); /* shorter than PATH_MAX */
+	raw[entry->name_len] = '\0';
+	normalize_path(raw, buf, sizeof(buf));
+
+	return strcmp(buf, name) == 0;
+}
+
+static const struct zip_entry *find_entry(const struct zip *zip,
+  uint64_t hash, const char *name)
+{
+	uint32_t lo = 0;
+	uint32_t hi = zip->entries_num;
+
+	while (lo < hi) { /* first entry with hash */
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (zip->entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < zip->entries_num && zip->entries[lo].hash == hash; ++lo) {
+		const struct zip_entry *entry = &zip->entries[lo];
+
+		if (same_name(entry, name))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static uint8_t inflate_entry(const uint8_t *data,
+  const struct zip_entry *entry, struct asset_info *ainfo)
+{
+	z_stream zs = {0};
+	size_t capacity;
+	uint8_t *buf;
+	int ret;
+
+	if (!(buf = pool_take(entry->len, &capacity))) {
+		ee("failed to allocate %u bytes\n", entry->len);
+		return 0;
+	} else if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) { /* raw deflate */
+		ee("failed to init inflate\n");
+		pool_give(buf, capacity);
+		return 0;
+	}
+
+	zs.next_in = (Bytef *) data;
+	zs.avail_in = entry->comp_len;
+	zs.next_out = buf;
+	zs.avail_out = entry->len;
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END || zs.total_out != entry->len ||
+	  crc32(0, buf, entry->len) != entry->crc) {
+		ee("failed to inflate %.*s\n", entry->name_len, entry->name);
+		pool_give(buf, capacity);
+		return 0;
+	}
+
+	ainfo->buf = buf;
+	ainfo->capacity = capacity;
+	ainfo->source = ASSET_INFLATED;
+
+	return 1;
+}
+
+static uint8_t open_entry(const struct zip *zip,
+  const struct zip_entry *entry, struct asset_info *ainfo)
+{
+	const uint8_t *local = zip->buf + entry->offset;
+
+	if ((size_t) entry->offset + LOCAL_LEN > zip->len ||
+	  rd32(local) != LOCAL_SIG) {
+		ee("bad local header of %.*s\n", entry->name_len, entry->name);
+		return 0;
+	}
+
+	const uint8_t *data = local + LOCAL_LEN + rd16(local + 26) +
+	  rd16(local + 28);
+
+	if (data + entry->comp_len > zip->buf + zip->len) {
+		ee("%.*s is out of archive\n", entry->name_len, entry->name);
+		return 0;
+	}
+
+	ainfo->len = entry->len;
+	ainfo->asset = zip;
+	ainfo->fd = -1;
+
+	if (entry->method == METHOD_DEFLATED)
+		return inflate_entry(data, entry, ainfo);
+	else if (entry->method != METHOD_STORED ||
+	  entry->comp_len != entry->len) {
+		ee("%.*s uses unsupported method %u\n", entry->name_len,
+		  entry->name, entry->method);
+		return 0;
+	}
+
+	ainfo->buf = data;
+	ainfo->source = ASSET_ZIP;
+
+	return 1;
+}
+
+uint8_t zip_find(const char *path, struct asset_info *ainfo)
+{
+	char name[PATH_MAX];
+
+	if (!mounted.zips_num)
+		return 0;
+
+	normalize_path(path, name, sizeof(name));
+
+	uint64_t hash = pack_hash(name);
+
+	for (uint8_t i = mounted.zips_num; i-- > 0; ) {
+		const struct zip *zip = &mounted.zips[i];
+		const struct zip_entry *entry = find_entry(zip, hash, name);
+
+		if (entry)
+			return open_entry(zip, entry, ainfo);
+	}
+
+	return 0;
+}
@@ -0,0 +1,109 @@
+/* rgu-cook.c: offline model cooker
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TAG "cook"
+
+#include <rgu/log.h>
+#include <rgu/wfobj.h>
+#include <rgu/texture.h>
+
+static void usage(const char *name)
+{
+	printf("usage: %s [options] -o <cache dir> <model.obj> ...\n"
+	  "  -t        ignore textures\n"
+	  "  -c r,g,b  model color; negative to use materials (default)\n"
+	  "  -O        optimize triangle and vertex order\n"
+	  "  -p        pack vertex attributes\n"
+	  "  -e        compress textures to etc1 and cache their mip chains\n"
+	  "\noptions must match ones used by application to load models\n",
+	  name);
+}
+
+/* shared textures are built once, later shapes hit the cache */
+
+static void cook_textures(struct model *model)
+{
+	struct list_head *cur;
+
+	list_walk(cur, &model->shapes) {
+		struct wfobj *shape = container_of(cur, struct wfobj, head);
+		struct mip_chain chain;
+
+		if (!shape->texname)
+			continue;
+		else if (!texture_decode(shape->texname, NULL, &chain))
+			ww("failed to cook texture %s\n", shape->texname);
+
+		mip_free(&chain);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct model opts = {0};
+	struct texture_policy policy = {0};
+	int opt;
+	int ret = 0;
+
+	opts.rgb.r = opts.rgb.g = opts.rgb.b = -1;
+
+	while ((opt = getopt(argc, argv, "tc:o:Opeh")) != -1) {
+		if (opt == 't') {
+			opts.ignore_texture = 1;
+		} else if (opt == 'c') {
+			if (sscanf(optarg, "%f,%f,%f", &opts.rgb.r, &opts.rgb.g,
+			  &opts.rgb.b) != 3) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (opt == 'O') {
+			opts.optimize = 1;
+		} else if (opt == 'p') {
+			opts.pack = 1;
+		} else if (opt == 'e') {
+			policy.compress = 1;
+		} else if (opt == 'o') {
+			opts.cache_dir = optarg;
+		} else {
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (!opts.cache_dir || optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (policy.compress) {
+		policy.cache_dir = opts.cache_dir;
+		texture_set_policy(&policy);
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		struct model model = opts;
+		char *path = strdup(argv[i]); /* prepare_model keeps basename */
+
+		if (!path || !prepare_model(path, &model, NULL)) {
+			ee("failed to cook %s\n", argv[i]);
+			ret = 1;
+		} else {
+			if (policy.compress)
+				cook_textures(&model);
+
+			erase_model(&model);
+		}
+
+		free(path);
+	}
+
+	return ret;
+}
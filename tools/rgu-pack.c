@@ -0,0 +1,277 @@
+/* rgu-pack.c: packed asset archive builder
+ *
+ * Copyright (c) 2019 Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * This source code is licensed under the BSD Zero Clause License found in
+ * the 0BSD file in the root directory of this source tree.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#define TAG "pack"
+
+#include <rgu/log.h>
+#include <rgu/pack.h>
+
+struct item {
+	char *path;
+	char *name; /* normalized path */
+	struct pack_entry entry;
+};
+
+static struct {
+	struct item *items;
+	uint32_t items_num;
+	uint32_t items_max;
+	uint8_t failed;
+} list;
+
+static void usage(const char *name)
+{
+	printf("usage: %s [options] -o <pack> <file or dir> ...\n"
+	  "  -C dir  change to dir first; paths are stored relative to it\n"
+	  "\nassets are looked up by same paths application passes to "
+	  "get_asset()\n", name);
+}
+
+static int add_file(const char *path, const struct stat *st, int type,
+  struct FTW *ftw)
+{
+	(void) ftw;
+
+	if (type != FTW_F)
+		return 0;
+	else if (st->st_size > UINT32_MAX) {
+		ee("%s is too big\n", path);
+		list.failed = 1;
+		return 0;
+	}
+
+	if (list.items_num == list.items_max) {
+		uint32_t max = list.items_max ? list.items_max * 2 : 256;
+		struct item *items = realloc(list.items, max * sizeof(*items));
+
+		if (!items) {
+			ee("failed to allocate %u items\n", max);
+			return -1;
+		}
+
+		list.items = items;
+		list.items_max = max;
+	}
+
+	struct item *item = &list.items[list.items_num];
+	char name[PATH_MAX];
+
+	normalize_path(path, name, sizeof(name));
+
+	if (!(item->path = strdup(path)) || !(item->name = strdup(name))) {
+		free(item->path);
+		return -1;
+	}
+
+	memset(&item->entry, 0, sizeof(item->entry));
+	item->entry.hash = pack_hash(name);
+	item->entry.len = st->st_size;
+	list.items_num++;
+
+	return 0;
+}
+
+static int cmp_items(const void *a, const void *b)
+{
+	const struct item *ia = a;
+	const struct item *ib = b;
+
+	if (ia->entry.hash != ib->entry.hash)
+		return ia->entry.hash < ib->entry.hash ? -1 : 1;
+
+	return strcmp(ia->name, ib->name);
+}
+
+/* same file listed twice is dropped; paths of same hash both stay */
+
+static void drop_duplicates(void)
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < list.items_num; ++i) {
+		struct item *item = &list.items[i];
+
+		if (n && list.items[n - 1].entry.hash == item->entry.hash &&
+		  strcmp(list.items[n - 1].name, item->name) == 0) {
+			free(item->path);
+			free(item->name);
+			continue;
+		}
+
+		list.items[n++] = *item;
+	}
+
+	list.items_num = n;
+}
+
+static inline uint64_t align(uint64_t offset)
+{
+	return (offset + PACK_ALIGN - 1) & ~((uint64_t) PACK_ALIGN - 1);
+}
+
+static uint8_t copy_file(const char *path, FILE *out, uint32_t len)
+{
+	char buf[64 * 1024];
+	FILE *fp = fopen(path, "rb");
+	size_t n;
+
+	if (!fp) {
+		ee("failed to open %s\n", path);
+		return 0;
+	}
+
+	while (len && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		n = n > len ? len : n;
+
+		if (fwrite(buf, 1, n, out) != n)
+			break;
+
+		len -= n;
+	}
+
+	fclose(fp);
+
+	if (len) {
+		ee("failed to copy %s\n", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static uint8_t write_pack(const char *path)
+{
+	struct pack_header hdr = {0};
+	uint64_t offset = sizeof(hdr) + list.items_num *
+	  sizeof(struct pack_entry);
+	uint8_t ret = 1;
+	FILE *fp;
+
+	for (uint32_t i = 0; i < list.items_num; ++i) {
+		if (offset > UINT32_MAX) {
+			ee("too many paths\n");
+			return 0;
+		}
+
+		list.items[i].entry.name = offset;
+		offset += strlen(list.items[i].name) + 1;
+	}
+
+	for (uint32_t i = 0; i < list.items_num; ++i) {
+		offset = align(offset);
+		list.items[i].entry.offset = offset;
+		offset += list.items[i].entry.len;
+	}
+
+	if (!(fp = fopen(path, "wb"))) {
+		ee("failed to create %s\n", path);
+		return 0;
+	}
+
+	hdr.magic = PACK_MAGIC;
+	hdr.version = PACK_VERSION;
+	hdr.entries = list.items_num;
+	ret = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	for (uint32_t i = 0; ret && i < list.items_num; ++i) {
+		ret = fwrite(&list.items[i].entry, sizeof(struct pack_entry), 1,
+		  fp) == 1;
+	}
+
+	for (uint32_t i = 0; ret && i < list.items_num; ++i) {
+		const char *name = list.items[i].name;
+
+		ret = fwrite(name, strlen(name) + 1, 1, fp) == 1;
+	}
+
+	for (uint32_t i = 0; ret && i < list.items_num; ++i) {
+		const struct item *item = &list.items[i];
+
+		ret = fseek(fp, item->entry.offset, SEEK_SET) == 0 &&
+		  copy_file(item->path, fp, item->entry.len);
+	}
+
+	/* payload of last item may be empty, pad file up to its offset */
+
+	if (ret && list.items_num && ftell(fp) < (long) offset)
+		ret = ftruncate(fileno(fp), offset) == 0;
+
+	if (fclose(fp) != 0 || !ret) {
+		ee("failed to write %s\n", path);
+		unlink(path);
+		return 0;
+	}
+
+	ii("packed %u files, %llu bytes\n", list.items_num,
+	  (unsigned long long) offset);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = NULL;
+	char out[PATH_MAX] = "";
+	int opt;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "o:C:h")) != -1) {
+		if (opt == 'o') {
+			/* output stays relative to where tool was started */
+			if (optarg[0] != '/' && getcwd(out, sizeof(out)))
+				strncat(out, "/", sizeof(out) - strlen(out) - 1);
+
+			strncat(out, optarg, sizeof(out) - strlen(out) - 1);
+		} else if (opt == 'C') {
+			dir = optarg;
+		} else {
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (!out[0] || optind == argc) {
+		usage(argv[0]);
+		return 1;
+	} else if (dir && chdir(dir) < 0) {
+		ee("failed to change to %s\n", dir);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		if (nftw(argv[i], add_file, 16, FTW_PHYS) != 0) {
+			ee("failed to walk %s\n", argv[i]);
+			list.failed = 1;
+		}
+	}
+
+	qsort(list.items, list.items_num, sizeof(*list.items), cmp_items);
+
+	drop_duplicates();
+
+	if (list.failed || !write_pack(out))
+		ret = 1;
+
+	for (uint32_t i = 0; i < list.items_num; ++i) {
+		free(list.items[i].path);
+		free(list.items[i].name);
+	}
+
+	free(list.items);
+	return ret;
+}